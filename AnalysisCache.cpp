@@ -0,0 +1,180 @@
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "AnalysisCache.h"
+#include "win32util.h"
+#include "strutil.h"
+
+namespace {
+    /*
+     * Whether the file an identity (size, mtime, path) was taken from is
+     * still there, unchanged.
+     */
+    bool is_current(const std::string &id)
+    {
+        long long size, sec;
+        long nsec;
+        int n = 0;
+        if (std::sscanf(id.c_str(), "%lld\t%lld.%ld\t%n",
+                        &size, &sec, &nsec, &n) != 3 || n <= 0)
+            return false;
+        struct stat st;
+        return stat(id.c_str() + n, &st) == 0 && S_ISREG(st.st_mode)
+            && st.st_size == size && st.st_mtim.tv_sec == sec
+            && st.st_mtim.tv_nsec == nsec;
+    }
+
+    std::string cache_directory()
+    {
+        const char *dir = getenv("XDG_CACHE_HOME");
+        if (dir && *dir == '/')
+            return strutil::format("%s/qaac", dir);
+        const char *home = getenv("HOME");
+        if (home && *home)
+            return strutil::format("%s/.cache/qaac", home);
+        return "";
+    }
+}
+
+void AnalysisCache::setIdentity(const std::shared_ptr<ISource> &src,
+                                const char *path)
+{
+    if (!std::strcmp(path, "-") || std::strpbrk(path, "\t\n"))
+        return;
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+        return;
+    std::string fullpath = win32::GetFullPathName(path);
+    if (fullpath.empty())
+        return;
+    std::string id = strutil::format("%lld\t%lld.%09ld\t",
+                                     static_cast<long long>(st.st_size),
+                                     static_cast<long long>(st.st_mtim.tv_sec),
+                                     st.st_mtim.tv_nsec);
+    id += fullpath;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_identities.begin(); it != m_identities.end();) {
+        if (it->second.first.expired())
+            it = m_identities.erase(it);
+        else
+            ++it;
+    }
+    m_identities[src.get()] = std::make_pair(src, id);
+}
+
+bool AnalysisCache::lookup(const std::shared_ptr<ISource> &src,
+                           const std::string &tag, Analysis *result)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string id = identity(src);
+    if (id.empty())
+        return false;
+    load();
+    auto it = m_entries.find(tag + "\t" + id);
+    if (it == m_entries.end())
+        return false;
+    *result = it->second;
+    return true;
+}
+
+void AnalysisCache::store(const std::shared_ptr<ISource> &src,
+                          const std::string &tag, const Analysis &analysis)
+{
+    if (tag.find_first_of("\t\n") != std::string::npos)
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string id = identity(src);
+    if (id.empty())
+        return;
+    load();
+    std::string key = tag + "\t" + id;
+    m_entries[key] = analysis;
+    if (m_path.empty())
+        return;
+    /* lines are short, so each one goes out in a single appending write */
+    std::string line = strutil::format("%.17g %.17g %.17g\t",
+                                       analysis.peak, analysis.true_peak,
+                                       analysis.loudness);
+    line += key + "\n";
+    FILE *fp = std::fopen(m_path.c_str(), "a");
+    if (fp) {
+        std::fputs(line.c_str(), fp);
+        std::fclose(fp);
+    }
+}
+
+std::string AnalysisCache::identity(const std::shared_ptr<ISource> &src)
+{
+    auto it = m_identities.find(src.get());
+    if (it == m_identities.end() || it->second.first.lock() != src)
+        return "";
+    return it->second.second;
+}
+
+void AnalysisCache::load()
+{
+    if (m_loaded)
+        return;
+    m_loaded = true;
+    std::string dir = cache_directory();
+    if (dir.empty() || !win32::MakeSureDirectoryPathExistsX(dir))
+        return;
+    m_path = dir + "/analysis";
+    FILE *fp = std::fopen(m_path.c_str(), "r");
+    if (!fp)
+        return;
+    std::shared_ptr<FILE> fileptr(fp, std::fclose);
+    std::string line;
+    size_t nlines = 0;
+    for (int c; (c = std::getc(fp)) != EOF;) {
+        if (c != '\n') {
+            line.push_back(c);
+            continue;
+        }
+        ++nlines;
+        Analysis a;
+        int n = 0;
+        if (std::sscanf(line.c_str(), "%lf %lf %lf\t%n",
+                        &a.peak, &a.true_peak, &a.loudness, &n) == 3 && n > 0)
+            m_entries[line.substr(n)] = a;
+        line.clear();
+    }
+    fileptr.reset();
+
+    /* forget files which have changed or gone away */
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        size_t pos = it->first.find('\t');
+        if (pos == std::string::npos || !is_current(it->first.substr(pos + 1)))
+            it = m_entries.erase(it);
+        else
+            ++it;
+    }
+    if (nlines != m_entries.size())
+        save();
+}
+
+/*
+ * Rewrites the file with one line per live entry, by way of a temporary
+ * file so that it is never seen half written. An entry another process
+ * appends in between is lost, which for a cache is harmless.
+ */
+void AnalysisCache::save()
+{
+    std::string tmppath = strutil::format("%s.%d", m_path.c_str(),
+                                          static_cast<int>(getpid()));
+    FILE *fp = std::fopen(tmppath.c_str(), "w");
+    if (!fp)
+        return;
+    bool ok = true;
+    for (auto it = m_entries.begin(); ok && it != m_entries.end(); ++it) {
+        const Analysis &a = it->second;
+        ok = std::fprintf(fp, "%.17g %.17g %.17g\t%s\n", a.peak, a.true_peak,
+                          a.loudness, it->first.c_str()) > 0;
+    }
+    if (std::fclose(fp) != 0)
+        ok = false;
+    if (!ok || std::rename(tmppath.c_str(), m_path.c_str()) != 0)
+        std::remove(tmppath.c_str());
+}
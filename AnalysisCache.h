@@ -0,0 +1,57 @@
+#ifndef ANALYSISCACHE_H
+#define ANALYSISCACHE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include "ISource.h"
+
+/*
+ * Remembers what --normalize measured on an input, so that encoding the
+ * same file again takes a single pass.
+ *
+ * An input is identified by its real path, size and modification time,
+ * and an entry is further qualified by a tag describing the filters the
+ * measurement was taken after. Entries are appended to a text file in
+ * $XDG_CACHE_HOME/qaac (or ~/.cache/qaac); later lines win. The file is
+ * compacted when loaded, dropping overwritten lines and inputs which
+ * have changed or gone.
+ */
+class AnalysisCache {
+public:
+    struct Analysis {
+        double peak;
+        double true_peak;
+        double loudness; /* LUFS */
+    };
+private:
+    std::mutex m_mutex;
+    bool m_loaded;
+    std::string m_path;
+    std::map<std::string, Analysis> m_entries;
+    /* identity of sources opened from a regular file */
+    std::map<const ISource *,
+             std::pair<std::weak_ptr<ISource>, std::string> > m_identities;
+
+    AnalysisCache(): m_loaded(false) {}
+    AnalysisCache(const AnalysisCache&);
+    AnalysisCache& operator=(const AnalysisCache&);
+public:
+    static AnalysisCache &instance()
+    {
+        static AnalysisCache self;
+        return self;
+    }
+    /* records which file src is reading; ignored for anything but files */
+    void setIdentity(const std::shared_ptr<ISource> &src, const char *path);
+    bool lookup(const std::shared_ptr<ISource> &src, const std::string &tag,
+                Analysis *result);
+    void store(const std::shared_ptr<ISource> &src, const std::string &tag,
+               const Analysis &analysis);
+private:
+    std::string identity(const std::shared_ptr<ISource> &src);
+    void load();
+    void save();
+};
+
+#endif
@@ -1,46 +1,69 @@
 #include "CompositeSource.h"
+#include "InputFactory.h"
 #include "strutil.h"
 
 size_t CompositeSource::readSamples(void *buffer, size_t nsamples)
 {
-    if (m_cur_file == m_sources.size())
-        return 0;
-    size_t rc = m_sources[m_cur_file]->readSamples(buffer, nsamples);
-    if (rc > 0) {
-        m_position += rc;
-        return rc;
-    } else {
-        ++m_cur_file;
-        if (m_cur_file < m_sources.size())
-            m_sources[m_cur_file]->seekTo(0);
-        return readSamples(buffer, nsamples);
+    while (m_cur_file < m_sources.size()) {
+        size_t rc = openPart(m_cur_file)->readSamples(buffer, nsamples);
+        if (rc > 0) {
+            m_position += rc;
+            return rc;
+        }
+        closePart(m_cur_file);
+        if (++m_cur_file < m_sources.size())
+            openPart(m_cur_file)->seekTo(0);
     }
+    return 0;
 }
 
 void CompositeSource::seekTo(int64_t pos)
 {
     uint64_t acc = 0;
-    for (m_cur_file = 0; m_cur_file < m_sources.size(); ++m_cur_file) {
-        uint64_t len = m_sources[m_cur_file]->length();
-        if (acc <= pos && pos < acc + len)
+    size_t n;
+    for (n = 0; n < m_sources.size(); ++n) {
+        uint64_t len = m_sources[n].length;
+        if (acc <= static_cast<uint64_t>(pos) &&
+            static_cast<uint64_t>(pos) < acc + len)
             break;
         acc += len;
     }
-    if (m_cur_file == m_sources.size())
+    if (pos < 0 || n == m_sources.size())
         throw std::runtime_error("Invalid seek offset");
-    m_sources[m_cur_file]->seekTo(pos - acc);
+    if (n != m_cur_file && m_cur_file < m_sources.size())
+        closePart(m_cur_file);
+    m_cur_file = n;
+    openPart(m_cur_file)->seekTo(pos - acc);
     m_position = pos;
 }
 
 void CompositeSource::addSource(const std::shared_ptr<ISeekableSource> &src)
 {
-    if (!count())
+    addPart(src, std::string());
+}
+
+void CompositeSource::addSource(const std::string &path)
+{
+    /* only to learn the format, length and tags; closed right away */
+    addPart(InputFactory::instance().openProbe(path.c_str()), path);
+}
+
+void CompositeSource::addPart(const std::shared_ptr<ISeekableSource> &src,
+                              const std::string &path)
+{
+    if (!count()) {
         m_asbd = src->getSampleFormat();
-    else if (std::memcmp(&m_asbd, &src->getSampleFormat(), sizeof m_asbd))
+        if ((m_has_channels = src->getChannels() != 0))
+            m_channels = *src->getChannels();
+    } else if (std::memcmp(&m_asbd, &src->getSampleFormat(), sizeof m_asbd))
         throw std::runtime_error("Concatenation of multiple inputs with "
                                  "different sample format is not supported");
-    m_sources.push_back(src);
     uint64_t len = src->length();
+    bool seekable = src->isSeekable();
+    /* a pipe can't be opened twice, so keep the one we have */
+    Part part = { seekable ? path : "", len, seekable,
+                  seekable && path.size() ? 0 : src };
+    m_sources.push_back(part);
     m_length = (len > ~0ULL - m_length) ? ~0ULL : m_length + len;
 
     /*
@@ -50,6 +73,12 @@ void CompositeSource::addSource(const std::shared_ptr<ISeekableSource> &src)
     auto parser = dynamic_cast<ITagParser*>(src.get());
     if (!parser)
         return;
+    /* artwork is interned, so the same picture is the same pointer */
+    if (m_sources.size() == 1)
+        m_artworks = parser->getArtworks();
+    else if (m_artworks != parser->getArtworks())
+        m_artworks.clear();
+
     auto tags = parser->getTags();
     bool is_empty = m_tags.empty();
     std::for_each(tags.begin(), tags.end(),
@@ -69,6 +98,20 @@ void CompositeSource::addSourceWithChapter(
                             const std::string &title)
 {
     addSource(src);
+    addChapterFor(src, title);
+}
+
+void CompositeSource::addSourceWithChapter(const std::string &path,
+                                           const std::string &title)
+{
+    auto src = InputFactory::instance().openProbe(path.c_str());
+    addPart(src, path);
+    addChapterFor(src, title);
+}
+
+void CompositeSource::addChapterFor(const std::shared_ptr<ISeekableSource> &src,
+                                    const std::string &title)
+{
     std::string name(title);
     auto parser = dynamic_cast<ITagParser*>(src.get());
     auto cp = dynamic_cast<IChapterParser*>(src.get());
@@ -87,3 +130,31 @@ void CompositeSource::addSourceWithChapter(
     }
     addChapter(name, src->length() / m_asbd.mSampleRate);
 }
+
+CompositeSource::source_t CompositeSource::openPart(size_t n)
+{
+    Part &part = m_sources[n];
+    if (!part.src) {
+        if (m_next.valid() && m_next_file == n)
+            part.src = m_next.get();
+        else
+            part.src = InputFactory::instance().openUncached(part.path.c_str());
+    }
+    /* get the next input ready while this one plays */
+    size_t next = n + 1;
+    if (next < m_sources.size() && !m_sources[next].path.empty() &&
+        !m_sources[next].src && !(m_next.valid() && m_next_file == next)) {
+        std::string path = m_sources[next].path;
+        m_next_file = next;
+        m_next = std::async(std::launch::async, [path] {
+            return InputFactory::instance().openUncached(path.c_str());
+        });
+    }
+    return part.src;
+}
+
+void CompositeSource::closePart(size_t n)
+{
+    if (!m_sources[n].path.empty())
+        m_sources[n].src.reset();
+}
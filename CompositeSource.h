@@ -1,25 +1,46 @@
 #ifndef _COMPOSITE_H
 #define _COMPOSITE_H
 
+#include <future>
 #include "ISource.h"
 
 class CompositeSource: public ISeekableSource, public ITagParser,
         public IChapterParser
 {
     typedef std::shared_ptr<ISeekableSource> source_t;
+    /*
+     * An input added by path is only a descriptor until it is about to
+     * play. Its decoder is opened on a background thread while the
+     * previous input is still being read, and closed as soon as it is
+     * done.
+     */
+    struct Part {
+        std::string path; /* empty when src is given by the caller */
+        uint64_t length;
+        bool seekable;
+        source_t src;
+    };
     uint32_t m_cur_file;
     int64_t m_position;
     uint64_t m_length;
-    std::vector<source_t> m_sources;
+    std::vector<Part> m_sources;
     std::map<std::string, std::string> m_tags;
+    std::vector<misc::blob_t> m_artworks;
     std::vector<misc::chapter_t> m_chapters;
     AudioStreamBasicDescription m_asbd;
+    bool m_has_channels;
+    std::vector<uint32_t> m_channels;
+    size_t m_next_file;
+    std::future<source_t> m_next;
 public:
-    CompositeSource() : m_cur_file(0), m_position(0), m_length(0) {}
+    CompositeSource()
+        : m_cur_file(0), m_position(0), m_length(0), m_has_channels(false),
+          m_next_file(0)
+    {}
 
     const std::vector<uint32_t> *getChannels() const
     {
-        return first()->getChannels();
+        return m_has_channels ? &m_channels : 0;
     }
     const AudioStreamBasicDescription &getSampleFormat() const
     {
@@ -31,7 +52,7 @@ public:
     bool isSeekable()
     {
         for (size_t i = 0; i < m_sources.size(); ++i)
-            if (!m_sources[i]->isSeekable())
+            if (!m_sources[i].seekable)
                 return false;
         return true;
     }
@@ -39,10 +60,11 @@ public:
 
     const std::map<std::string, std::string> &getTags() const
     {
-        if (m_tags.size()) return m_tags;
-        std::shared_ptr<ISource> src = first();
-        ITagParser *tp = dynamic_cast<ITagParser*>(src.get());
-        return tp ? tp->getTags() : m_tags;
+        return m_tags;
+    }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        return m_artworks;
     }
     const std::vector<misc::chapter_t> &getChapters() const
     {
@@ -55,9 +77,17 @@ public:
     void addSource(const std::shared_ptr<ISeekableSource> &src);
     void addSourceWithChapter(const std::shared_ptr<ISeekableSource> &src,
                               const std::string &title);
+    void addSource(const std::string &path);
+    void addSourceWithChapter(const std::string &path,
+                              const std::string &title);
     size_t count() const { return m_sources.size(); }
 private:
-    std::shared_ptr<ISeekableSource> first() const { return m_sources[0]; }
+    void addPart(const std::shared_ptr<ISeekableSource> &src,
+                 const std::string &path);
+    void addChapterFor(const std::shared_ptr<ISeekableSource> &src,
+                       const std::string &title);
+    source_t openPart(size_t n);
+    void closePart(size_t n);
     void addChapter(std::string title, double length)
     {
         m_chapters.push_back(std::make_pair(title, length));
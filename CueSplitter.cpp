@@ -0,0 +1,147 @@
+#include <cerrno>
+#include <unistd.h>
+#include "CueSplitter.h"
+#include "win32util.h"
+
+namespace {
+    const size_t NSAMPLES = 0x1000;
+}
+
+CueSplitter::CueSplitter(
+        const std::vector<std::shared_ptr<ISeekableSource>> &tracks)
+    : m_quit(false)
+{
+    for (size_t i = 0; i < tracks.size(); ++i) {
+        Track t = { tracks[i], 0, 0, false, false, false };
+        m_tracks.push_back(t);
+    }
+    m_thread = std::thread(&CueSplitter::inputThreadProc, this);
+}
+
+CueSplitter::~CueSplitter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+std::shared_ptr<ISeekableSource> CueSplitter::track(size_t n)
+{
+    return std::make_shared<CueSplitTrack>(shared_from_this(), n);
+}
+
+size_t CueSplitter::read(size_t n, int64_t pos, void *buffer,
+                         size_t nsamples)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Track &t = m_tracks[n];
+    if (!t.requested) {
+        t.requested = true;
+        m_cond.notify_all();
+    }
+    uint64_t upos = pos;
+    m_cond.wait(lock, [&] {
+        return t.written > upos || t.done || m_error;
+    });
+    if (t.written <= upos) {
+        if (m_error)
+            std::rethrow_exception(m_error);
+        return 0;
+    }
+    nsamples = std::min(static_cast<uint64_t>(nsamples), t.written - upos);
+    std::shared_ptr<FILE> spool = t.spool;
+    lock.unlock();
+
+    uint32_t bpf = t.src->getSampleFormat().mBytesPerFrame;
+    uint8_t *bp = static_cast<uint8_t*>(buffer);
+    size_t size = nsamples * bpf, done = 0;
+    while (done < size) {
+        ssize_t rc = pread(fileno(spool.get()), bp + done, size - done,
+                           pos * bpf + done);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0)
+            util::throw_crt_error("pread()");
+        if (rc == 0)
+            throw std::runtime_error("CueSplitter: spool file is truncated");
+        done += rc;
+    }
+    return nsamples;
+}
+
+void CueSplitter::close(size_t n)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tracks[n].closed = true;
+        m_tracks[n].spool.reset();
+    }
+    m_cond.notify_all();
+}
+
+void CueSplitter::inputThreadProc()
+{
+    try {
+        for (size_t k = 0; k < m_tracks.size(); ++k) {
+            Track &t = m_tracks[k];
+            std::shared_ptr<FILE> spool;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [&] {
+                    return m_quit || t.requested || t.closed;
+                });
+                if (m_quit)
+                    break;
+                if (t.closed)
+                    continue;
+                spool = t.spool = win32::tmpfile("qaac.cue");
+            }
+            /*
+             * Tracks are contiguous in the image, so this is normally a
+             * no-op and the decoder just carries on from where the
+             * previous track ended.
+             */
+            t.src->seekTo(0);
+
+            int fd = fileno(spool.get());
+            uint32_t bpf = t.src->getSampleFormat().mBytesPerFrame;
+            std::vector<uint8_t> buffer(NSAMPLES * bpf);
+            uint64_t written = 0;
+            size_t n;
+            while ((n = t.src->readSamples(buffer.data(), NSAMPLES)) > 0) {
+                win32::tmpfile_reserve(fd, (written + n) * bpf);
+                size_t size = n * bpf, done = 0;
+                while (done < size) {
+                    ssize_t rc = pwrite(fd, buffer.data() + done, size - done,
+                                        written * bpf + done);
+                    if (rc < 0 && errno == EINTR)
+                        continue;
+                    if (rc < 0)
+                        util::throw_crt_error("pwrite()");
+                    done += rc;
+                }
+                written += n;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (m_quit || t.closed)
+                        break;
+                    t.written = written;
+                }
+                m_cond.notify_all();
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                t.done = true;
+            }
+            m_cond.notify_all();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = std::current_exception();
+    }
+    m_cond.notify_all();
+}
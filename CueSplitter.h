@@ -0,0 +1,90 @@
+#ifndef CUE_SPLITTER_H
+#define CUE_SPLITTER_H
+
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <condition_variable>
+#include "ISource.h"
+
+/*
+ * Decodes the tracks of a cuesheet image front to back on its own thread,
+ * spooling each track to a temporary file as it passes. Several tracks can
+ * then be encoded concurrently while the image is decoded only once.
+ * A track is not decoded until its reader asks for it, so the look-ahead
+ * is bounded by the number of tracks actually being encoded.
+ */
+class CueSplitter: public std::enable_shared_from_this<CueSplitter> {
+    struct Track {
+        std::shared_ptr<ISeekableSource> src;
+        std::shared_ptr<FILE> spool;
+        uint64_t written;
+        bool requested, done, closed;
+    };
+    std::vector<Track> m_tracks;
+    bool m_quit;
+    std::exception_ptr m_error;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+public:
+    explicit CueSplitter(
+            const std::vector<std::shared_ptr<ISeekableSource>> &tracks);
+    ~CueSplitter();
+    std::shared_ptr<ISeekableSource> track(size_t n);
+    size_t read(size_t n, int64_t pos, void *buffer, size_t nsamples);
+    void close(size_t n);
+    const std::shared_ptr<ISeekableSource> &sourcePtr(size_t n) const
+    {
+        return m_tracks[n].src;
+    }
+private:
+    void inputThreadProc();
+};
+
+class CueSplitTrack: public ISeekableSource, public ITagParser {
+    std::shared_ptr<CueSplitter> m_splitter;
+    size_t m_index;
+    int64_t m_position;
+    std::map<std::string, std::string> m_emptyTags;
+public:
+    CueSplitTrack(const std::shared_ptr<CueSplitter> &splitter, size_t index)
+        : m_splitter(splitter), m_index(index), m_position(0)
+    {}
+    ~CueSplitTrack() { m_splitter->close(m_index); }
+    uint64_t length() const { return source()->length(); }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return source()->getSampleFormat();
+    }
+    const std::vector<uint32_t> *getChannels() const
+    {
+        return source()->getChannels();
+    }
+    int64_t getPosition() { return m_position; }
+    size_t readSamples(void *buffer, size_t nsamples)
+    {
+        size_t n = m_splitter->read(m_index, m_position, buffer, nsamples);
+        m_position += n;
+        return n;
+    }
+    bool isSeekable() { return true; }
+    void seekTo(int64_t count) { m_position = count; }
+    const std::map<std::string, std::string> &getTags() const
+    {
+        ITagParser *parser = dynamic_cast<ITagParser*>(source().get());
+        return parser ? parser->getTags() : m_emptyTags;
+    }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        ITagParser *parser = dynamic_cast<ITagParser*>(source().get());
+        return parser ? parser->getArtworks() : ITagParser::getArtworks();
+    }
+private:
+    const std::shared_ptr<ISeekableSource> &source() const
+    {
+        return m_splitter->sourcePtr(m_index);
+    }
+};
+
+#endif
@@ -52,6 +52,18 @@ namespace {
             atomic_h2s_table.compare_exchange_strong(expected, p, std::memory_order_release, std::memory_order_relaxed);
         }
     }
+
+    template <typename T, typename Convert>
+    void deinterleave(const T *src, float * const *channels, size_t nsamples,
+                      unsigned nchannels, Convert convert)
+    {
+        for (unsigned n = 0; n < nchannels; ++n) {
+            const T *sp = src + n;
+            float *dp = channels[n];
+            for (size_t i = 0; i < nsamples; ++i, sp += nchannels)
+                dp[i] = convert(*sp);
+        }
+    }
 }
 
 size_t readSamplesFull(ISource *src, void *buffer, size_t nsamples)
@@ -66,6 +78,19 @@ size_t readSamplesFull(ISource *src, void *buffer, size_t nsamples)
     return nsamples - rest;
 }
 
+size_t borrowSamples(ISource *src, std::vector<uint8_t> *pivot,
+                     const void **data, size_t nsamples)
+{
+    IBorrowableSource *bs = dynamic_cast<IBorrowableSource*>(src);
+    if (bs)
+        return bs->borrowSamples(data, nsamples);
+    size_t size = nsamples * src->getSampleFormat().mBytesPerFrame;
+    if (pivot->size() < size)
+        pivot->resize(size);
+    *data = pivot->data();
+    return src->readSamples(pivot->data(), nsamples);
+}
+
 size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
                           std::vector<float> *floatBuffer, size_t nsamples)
 {
@@ -84,20 +109,17 @@ size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
     if ((sf.mFormatFlags & kAudioFormatFlagIsFloat) && bpc == 4)
         return src->readSamples(floatBuffer, nsamples);
 
-    if (pivot->size() < nsamples * sf.mBytesPerFrame)
-        pivot->resize(nsamples * sf.mBytesPerFrame);
-
-    void *bp = &(*pivot)[0];
+    const void *bp;
     float *fp = floatBuffer;
-    nsamples = src->readSamples(bp, nsamples);
+    nsamples = borrowSamples(src, pivot, &bp, nsamples);
     size_t blen = nsamples * sf.mBytesPerFrame;
 
     if (sf.mFormatFlags & kAudioFormatFlagIsFloat) {
         if (bpc == 8) {
-            double *src = static_cast<double *>(bp);
+            const double *src = static_cast<const double *>(bp);
             std::transform(src, src + (blen / 8), fp, quantize);
         } else if (bpc == 2) {
-            uint16_t *src = static_cast<uint16_t *>(bp);
+            const uint16_t *src = static_cast<const uint16_t *>(bp);
             init_h2s_table();
             for (size_t i = 0; i < blen / 2; ++i)
                 *fp++ = h2s_table[src[i]].f / 65536.0;
@@ -105,7 +127,7 @@ size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
             throw std::runtime_error("readSamplesAsFloat(): BUG");
         }
     } else {
-        int *src = static_cast<int *>(bp);
+        const int *src = static_cast<const int *>(bp);
         for (size_t i = 0; i < blen / 4; ++i)
             *fp++ = src[i] / 2147483648.0f;
     }
@@ -130,20 +152,17 @@ size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
     if ((sf.mFormatFlags & kAudioFormatFlagIsFloat) && bpc == 8)
         return src->readSamples(doubleBuffer, nsamples);
 
-    if (pivot->size() < nsamples * sf.mBytesPerFrame)
-        pivot->resize(nsamples * sf.mBytesPerFrame);
-
-    void *bp = &(*pivot)[0];
+    const void *bp;
     double *fp = doubleBuffer;
-    nsamples = src->readSamples(bp, nsamples);
+    nsamples = borrowSamples(src, pivot, &bp, nsamples);
     size_t blen = nsamples * sf.mBytesPerFrame;
 
     if (sf.mFormatFlags & kAudioFormatFlagIsFloat) {
         if (bpc == 4) {
-            float *src = static_cast<float*>(bp);
+            const float *src = static_cast<const float*>(bp);
             std::copy(src, src + (blen / 4), fp);
         } else if (bpc == 2) {
-            uint16_t *src = static_cast<uint16_t *>(bp);
+            const uint16_t *src = static_cast<const uint16_t *>(bp);
             init_h2s_table();
             for (size_t i = 0; i < blen / 2; ++i) {
                 *fp++ = h2s_table[src[i]].f / 65536.0;
@@ -152,10 +171,47 @@ size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
             throw std::runtime_error("readSamplesAsFloat(): BUG");
         }
     } else {
-        int *src = static_cast<int *>(bp);
+        const int *src = static_cast<const int *>(bp);
         for (size_t i = 0; i < blen / 4; ++i)
             *fp++ = src[i] / 2147483648.0;
     }
     return nsamples;
 }
 
+
+size_t readSamplesPlanar(ISource *src, std::vector<uint8_t> *pivot,
+                         float * const *channels, size_t nsamples)
+{
+    IPlanarSource *ps = dynamic_cast<IPlanarSource*>(src);
+    if (ps)
+        return ps->readPlanar(channels, nsamples);
+
+    const AudioStreamBasicDescription &sf = src->getSampleFormat();
+    unsigned nc = sf.mChannelsPerFrame;
+    uint32_t bpc = sf.mBytesPerFrame / nc;
+    const void *bp;
+    nsamples = borrowSamples(src, pivot, &bp, nsamples);
+
+    if (sf.mFormatFlags & kAudioFormatFlagIsFloat) {
+        if (bpc == 4) {
+            deinterleave(static_cast<const float *>(bp), channels, nsamples,
+                         nc, [](float x) { return x; });
+        } else if (bpc == 8) {
+            deinterleave(static_cast<const double *>(bp), channels, nsamples,
+                         nc, quantize);
+        } else if (bpc == 2) {
+            init_h2s_table();
+            const uif_t *table = atomic_h2s_table.load();
+            deinterleave(static_cast<const uint16_t *>(bp), channels,
+                         nsamples, nc, [table](uint16_t x) {
+                             return static_cast<float>(table[x].f / 65536.0);
+                         });
+        } else {
+            throw std::runtime_error("readSamplesPlanar(): BUG");
+        }
+    } else {
+        deinterleave(static_cast<const int *>(bp), channels, nsamples, nc,
+                     [](int x) { return x / 2147483648.0f; });
+    }
+    return nsamples;
+}
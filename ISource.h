@@ -21,9 +21,40 @@ struct ISeekableSource: public ISource {
     virtual void seekTo(int64_t offset) = 0;
 };
 
+/*
+ * For sources which can hand out samples without copying them.
+ * borrowSamples() works like readSamples(), except that *data is pointed
+ * at up to nsamples frames held by the source itself. The memory must not
+ * be written to, and is valid until the next call on the source.
+ */
+struct IBorrowableSource {
+    virtual ~IBorrowableSource() {}
+    virtual size_t borrowSamples(const void **data, size_t nsamples) = 0;
+};
+
+/*
+ * For sources producing float32 which can hand it out one channel at a
+ * time. readPlanar() works like readSamples(), except that channel n of
+ * frame i goes to channels[n][i]. Read through readSamplesPlanar(), which
+ * falls back to splitting interleaved samples for other sources.
+ */
+struct IPlanarSource {
+    virtual ~IPlanarSource() {}
+    virtual size_t readPlanar(float * const *channels, size_t nsamples) = 0;
+};
+
 struct ITagParser {
     virtual ~ITagParser() {}
     virtual const std::map<std::string, std::string> &getTags() const = 0;
+    /*
+     * Front cover pictures. They are kept out of getTags(), so that tag
+     * maps stay cheap to copy around.
+     */
+    virtual const std::vector<misc::blob_t> &getArtworks() const
+    {
+        static const std::vector<misc::blob_t> none;
+        return none;
+    }
 };
 
 struct IChapterParser {
@@ -33,6 +64,10 @@ struct IChapterParser {
 
 size_t readSamplesFull(ISource *src, void *buffer, size_t nsamples);
 
+/* borrows from src if it can lend, otherwise reads into pivot */
+size_t borrowSamples(ISource *src, std::vector<uint8_t> *pivot,
+                     const void **data, size_t nsamples);
+
 size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
                           std::vector<float> *floatBuffer, size_t nsamples);
 
@@ -45,4 +80,8 @@ size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
 size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
                           double *floatBuffer, size_t nsamples);
 
+/* samples converted to float32, one plane per channel */
+size_t readSamplesPlanar(ISource *src, std::vector<uint8_t> *pivot,
+                         float * const *channels, size_t nsamples);
+
 #endif
@@ -50,7 +50,13 @@ public:
 
     void seekTo(int64_t count)
     {
-        m_src->seekTo(m_start + count);
+        /*
+         * Adjacent cue segments share the same decoder; don't make it
+         * reset and pre-roll when it is already where we want it.
+         */
+        int64_t pos = m_start + count;
+        if (m_src->getPosition() != pos)
+            m_src->seekTo(pos);
         m_position = count;
     }
 
@@ -62,6 +68,11 @@ public:
         else
             return parser->getTags();
     }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        ITagParser *parser = dynamic_cast<ITagParser*>(m_src.get());
+        return parser ? parser->getArtworks() : ITagParser::getArtworks();
+    }
 
     void setRange(uint64_t start, uint64_t duration)
     {
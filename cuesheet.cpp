@@ -9,6 +9,7 @@
 #include "NullSource.h"
 #include "TrimmedSource.h"
 #include "InputFactory.h"
+#include "IndependentSource.h"
 
 static inline
 unsigned msf2frames(unsigned mm, unsigned ss, unsigned ff)
@@ -151,7 +152,7 @@ void CueSheet::parse(std::streambuf *src)
 
 std::vector<std::shared_ptr<ISeekableSource>>
 CueSheet::loadTracks(bool is_embedded, const std::string &path,
-                     const std::vector<int> &selection)
+                     const std::vector<int> &selection, bool independent)
 {
     std::vector<std::shared_ptr<ISeekableSource>> tracks;
     for (auto track = begin(); track != end(); ++track) {
@@ -164,14 +165,21 @@ CueSheet::loadTracks(bool is_embedded, const std::string &path,
         std::for_each(track->begin(), track->end(), [&](const CueSegment &seg) {
             std::shared_ptr<ISeekableSource> src;
             if (seg.m_filename == "__GAP__") {
-                if (tracks.size())
-                    src.reset(new NullSource(src->getSampleFormat()));
-            } else if (is_embedded) {
-                src = InputFactory::instance().open(path.c_str());
+                if (track_source->count())
+                    src.reset(new NullSource(track_source->getSampleFormat()));
+                else if (tracks.size())
+                    src.reset(new NullSource(tracks.back()->getSampleFormat()));
             } else {
                 std::string ifilename =
-                    win32::PathCombineX(path, seg.m_filename);
+                    is_embedded ? path
+                                : win32::PathCombineX(path, seg.m_filename);
                 src = InputFactory::instance().open(ifilename.c_str());
+                /*
+                 * The shared instance only serves as a prototype; each
+                 * track then seeks a decoder of its own.
+                 */
+                if (independent && src->isSeekable())
+                    src = std::make_shared<IndependentSource>(src, ifilename);
             }
             if (src.get()) {
                 double rate = src->getSampleFormat().mSampleRate;
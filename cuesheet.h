@@ -85,7 +85,8 @@ public:
     std::vector<std::shared_ptr<ISeekableSource>>
         loadTracks(bool is_embedded,
                    const std::string &cue_or_container_path,
-                   const std::vector<int> &selection);
+                   const std::vector<int> &selection,
+                   bool independent=false);
     std::map<std::string, std::string> getTags() const;
 
     unsigned count() const { return m_tracks.size(); }
@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <utility>
 #include "ChannelMapper.h"
 #include "util.h"
 #include "chanmap.h"
@@ -6,7 +9,9 @@
 ChannelMapper::ChannelMapper(const std::shared_ptr<ISource> &source,
                              const std::vector<uint32_t> &chanmap,
                              uint32_t bitmap, uint32_t layout_tag)
-    : FilterBase(source)
+    : FilterBase(source),
+      m_lender_of(source.get()),
+      m_lender(dynamic_cast<IBorrowableSource*>(source.get()))
 {
     const AudioStreamBasicDescription &asbd = source->getSampleFormat();
     assert(chanmap.size() == asbd.mChannelsPerFrame);
@@ -31,57 +36,110 @@ ChannelMapper::ChannelMapper(const std::shared_ptr<ISource> &source,
     else {
         switch (asbd.mBytesPerFrame / asbd.mChannelsPerFrame) {
         case 2:
-            m_process = &ChannelMapper::process16; break;
+            m_process = select<uint16_t>(chanmap.size()); break;
         case 4:
-            m_process = &ChannelMapper::process32; break;
+            m_process = select<uint32_t>(chanmap.size()); break;
         case 8:
-            m_process = &ChannelMapper::process64; break;
+            m_process = select<uint64_t>(chanmap.size()); break;
         default:
             assert(0);
         }
     }
 }
 
+template <typename T>
+ChannelMapper::process_t ChannelMapper::select(unsigned nchannels)
+{
+    switch (nchannels) {
+    case 2: return &ChannelMapper::processT<T, 2>;
+    case 3: return &ChannelMapper::processT<T, 3>;
+    case 4: return &ChannelMapper::processT<T, 4>;
+    case 5: return &ChannelMapper::processT<T, 5>;
+    case 6: return &ChannelMapper::processT<T, 6>;
+    case 7: return &ChannelMapper::processT<T, 7>;
+    case 8: return &ChannelMapper::processT<T, 8>;
+    }
+    return &ChannelMapper::processT<T, 0>;
+}
+
 size_t ChannelMapper::processNothing(void *buffer, size_t nsamples)
 {
     return source()->readSamples(buffer, nsamples);
 }
 
-template <typename T>
-size_t ChannelMapper::processT(T *buffer, size_t nsamples)
+/* identity maps pass through whatever upstream lends */
+size_t ChannelMapper::borrowSamples(const void **data, size_t nsamples)
 {
-    unsigned nchannels = source()->getSampleFormat().mChannelsPerFrame;
-    const uint32_t *chanmap = &m_chanmap[0];
-    T work[8], *bp = buffer;
-
-    nsamples = source()->readSamples(buffer, nsamples);
-    for (size_t i = 0; i < nsamples; ++i, bp += nchannels) {
-        memcpy(work, bp, sizeof(T) * nchannels);
-        switch (nchannels) {
-        case 8: bp[7] = work[chanmap[7]];
-        case 7: bp[6] = work[chanmap[6]];
-        case 6: bp[5] = work[chanmap[5]];
-        case 5: bp[4] = work[chanmap[4]];
-        case 4: bp[3] = work[chanmap[3]];
-        case 3: bp[2] = work[chanmap[2]];
-        case 2: bp[1] = work[chanmap[1]];
-        case 1: bp[0] = work[chanmap[0]];
-        }
-    }
-    return nsamples;
+    if (m_process == &ChannelMapper::processNothing)
+        return ::borrowSamples(source(), &m_pivot, data, nsamples);
+    size_t size = nsamples * getSampleFormat().mBytesPerFrame;
+    if (m_lent.size() < size)
+        m_lent.resize(size);
+    *data = m_lent.data();
+    return readSamples(m_lent.data(), nsamples);
 }
 
-size_t ChannelMapper::process16(void *buffer, size_t nsamples)
+/* frame by frame, N channels spelled out; ip and op may be the same */
+template <typename T, unsigned... I>
+static void permute(const T *ip, T *op, size_t nsamples,
+                    const uint32_t *chanmap,
+                    std::integer_sequence<unsigned, I...>)
 {
-    return processT(static_cast<uint16_t *>(buffer), nsamples);
+    const uint32_t map[] = { chanmap[I]... };
+    for (size_t i = 0; i < nsamples; ++i) {
+        const T work[] = { ip[map[I]]... };
+        ((op[I] = work[I]), ...);
+        ip += sizeof...(I);
+        op += sizeof...(I);
+    }
 }
 
-size_t ChannelMapper::process32(void *buffer, size_t nsamples)
+/*
+ * With N known at compile time, the gather is unrolled by the template
+ * itself rather than left to the optimizer, which doesn't at -O1.
+ * N == 0 is the fallback for any number of channels.
+ * ip and op may be the same.
+ */
+template <typename T, unsigned N>
+static void permute(const T *ip, T *op, size_t nsamples, unsigned nchannels,
+                    const uint32_t *chanmap)
 {
-    return processT(static_cast<uint32_t *>(buffer), nsamples);
+    if constexpr (N > 0) {
+        permute(ip, op, nsamples, chanmap,
+                std::make_integer_sequence<unsigned, N>());
+    } else {
+        uint32_t map[8];
+        std::copy(chanmap, chanmap + nchannels, map);
+        T work[8];
+        for (size_t i = 0; i < nsamples; ++i) {
+            std::memcpy(work, ip, sizeof(T) * nchannels);
+            for (unsigned n = 0; n < nchannels; ++n)
+                op[n] = work[map[n]];
+            ip += nchannels;
+            op += nchannels;
+        }
+    }
 }
 
-size_t ChannelMapper::process64(void *buffer, size_t nsamples)
+/*
+ * When upstream can lend its samples, they are permuted on their way to
+ * buffer, instead of being copied there first and permuted in place.
+ */
+template <typename T, unsigned N>
+size_t ChannelMapper::processT(void *buffer, size_t nsamples)
 {
-    return processT(static_cast<uint64_t *>(buffer), nsamples);
+    ISource *src = source();
+    if (src != m_lender_of) {
+        m_lender_of = src;
+        m_lender = dynamic_cast<IBorrowableSource*>(src);
+    }
+    unsigned nchannels = src->getSampleFormat().mChannelsPerFrame;
+    const void *data = buffer;
+    if (m_lender)
+        nsamples = m_lender->borrowSamples(&data, nsamples);
+    else
+        nsamples = src->readSamples(buffer, nsamples);
+    permute<T, N>(static_cast<const T*>(data), static_cast<T*>(buffer),
+                  nsamples, nchannels, m_chanmap.data());
+    return nsamples;
 }
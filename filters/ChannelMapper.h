@@ -3,10 +3,16 @@
 
 #include "FilterBase.h"
 
-class ChannelMapper: public FilterBase {
+class ChannelMapper: public FilterBase, public IBorrowableSource {
     std::vector<uint32_t> m_chanmap;
     std::vector<uint32_t> m_layout;
-    size_t (ChannelMapper::*m_process)(void *, size_t);
+    std::vector<uint8_t> m_pivot;
+    std::vector<uint8_t> m_lent; /* what borrowSamples() hands out */
+    /* source() as IBorrowableSource, looked up again if it's replaced */
+    ISource *m_lender_of;
+    IBorrowableSource *m_lender;
+    typedef size_t (ChannelMapper::*process_t)(void *, size_t);
+    process_t m_process;
 public:
     ChannelMapper(const std::shared_ptr<ISource> &source,
                   const std::vector<uint32_t> &chanmap,
@@ -19,13 +25,14 @@ public:
     {
         return (this->*m_process)(buffer, nsamples);
     }
+    size_t borrowSamples(const void **data, size_t nsamples);
+    /* output channel n is input channel chanmap()[n], zero based */
+    const std::vector<uint32_t> &chanmap() const { return m_chanmap; }
 private:
     size_t processNothing(void *buffer, size_t nsamples);
-    template <typename T>
-    size_t processT(T *buffer, size_t nsamples);
-    size_t process16(void *buffer, size_t nsamples);
-    size_t process32(void *buffer, size_t nsamples);
-    size_t process64(void *buffer, size_t nsamples);
+    template <typename T> process_t select(unsigned nchannels);
+    template <typename T, unsigned N>
+    size_t processT(void *buffer, size_t nsamples);
 };
 
 #endif
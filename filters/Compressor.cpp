@@ -1,8 +1,15 @@
+#include <cmath>
 #include <numeric>
 #include "Compressor.h"
 #include "cautil.h"
+#include "simd.h"
+
+using namespace simd;
 
 namespace {
+    const size_t STAT_BLOCK = 0x10000;
+    const double DB_PER_OCTAVE = 6.020599913279624; /* 20 * log10(2) */
+
     template <typename T>
     inline T frame_amplitude(const T *frame, unsigned nchannels)
     {
@@ -11,6 +18,97 @@ namespace {
                                   return std::max(acc, std::abs(x));
                                });
     }
+
+    inline v4sf splat(float x) { return v4sf{} + x; }
+
+    template <typename To, typename From> inline To bitcast(From x)
+    {
+        To y;
+        std::memcpy(&y, &x, sizeof y);
+        return y;
+    }
+
+    /*
+     * log2(x), absolute error within 1e-6. Anything below 2^-100
+     * (-602dB), zero included, is taken as 2^-100.
+     */
+    inline v4sf fast_log2(v4sf x)
+    {
+        x = x < splat(0x1p-100f) ? splat(0x1p-100f) : x;
+        v4si i = bitcast<v4si>(x);
+        v4si e = ((i >> 23) & 0xff) - 127;
+        v4sf m = bitcast<v4sf>((i & 0x7fffff) | 0x3f800000);
+        /* m to [sqrt(1/2), sqrt(2)), then ln(m) = 2 atanh((m-1)/(m+1)) */
+        v4si big = m > splat(1.41421356f);
+        m = big ? m * 0.5f : m;
+        e -= big;
+        v4sf t = (m - 1.0f) / (m + 1.0f), t2 = t * t;
+        v4sf p = splat(2.0f / 9);
+        p = p * t2 + 2.0f / 7;
+        p = p * t2 + 2.0f / 5;
+        p = p * t2 + 2.0f / 3;
+        p = p * t2 + 2.0f;
+        return __builtin_convertvector(e, v4sf) + (p * t) * float(M_LOG2E);
+    }
+
+    /* 2^x, relative error within 1e-6; x is clamped to [-126, 126] */
+    inline v4sf fast_exp2(v4sf x)
+    {
+        x = x < splat(-126.0f) ? splat(-126.0f) : x;
+        x = x > splat(126.0f) ? splat(126.0f) : x;
+        /* n = round(x), f in [-0.5, 0.5] */
+        v4sf h = x + 0.5f;
+        v4si n = __builtin_convertvector(h, v4si);
+        n += __builtin_convertvector(n, v4sf) > h;
+        v4sf f = (x - __builtin_convertvector(n, v4sf)) * float(M_LN2);
+        v4sf p = splat(1.0f / 720);
+        p = p * f + 1.0f / 120;
+        p = p * f + 1.0f / 24;
+        p = p * f + 1.0f / 6;
+        p = p * f + 0.5f;
+        p = p * f + 1.0f;
+        p = p * f + 1.0f;
+        return p * bitcast<v4sf>((n + 127) << 23);
+    }
+
+    template <v4sf (*F)(v4sf)> void transform(float *x, size_t n)
+    {
+        for (size_t i = 0; i < n; i += 4) {
+            v4sf v = {};
+            size_t k = std::min(n - i, static_cast<size_t>(4));
+            std::memcpy(&v, x + i, k * sizeof(float));
+            v = F(v);
+            std::memcpy(x + i, &v, k * sizeof(float));
+        }
+    }
+
+    void apply_gain(float *data, const float *gain, size_t nframes,
+                    unsigned nchannels)
+    {
+        size_t i = 0;
+        if (nchannels == 1) {
+            for (; i + 4 <= nframes; i += 4)
+                store(data + i, load(data + i) * load(gain + i));
+        } else if (nchannels == 2) {
+            for (; i + 2 <= nframes; i += 2) {
+                v4sf g = { gain[i], gain[i], gain[i+1], gain[i+1] };
+                store(data + i * 2, load(data + i * 2) * g);
+            }
+        } else if (nchannels >= 4) {
+            for (; i < nframes; ++i) {
+                float *p = data + i * nchannels;
+                v4sf g = splat(gain[i]);
+                unsigned n = 0;
+                for (; n + 4 <= nchannels; n += 4)
+                    store(p + n, load(p + n) * g);
+                for (; n < nchannels; ++n)
+                    p[n] *= gain[i];
+            }
+        }
+        for (; i < nframes; ++i)
+            for (unsigned n = 0; n < nchannels; ++n)
+                data[i * nchannels + n] *= gain[i];
+    }
 }
 
 Compressor::Compressor(const std::shared_ptr<ISource> &src,
@@ -29,12 +127,19 @@ Compressor::Compressor(const std::shared_ptr<ISource> &src,
       m_yA(std::numeric_limits<double>::quiet_NaN()),
       m_eof(false),
       m_position(0),
+      m_head(0),
+      m_tail(0),
       m_statfile(statfp)
 {
     const AudioStreamBasicDescription &asbd = src->getSampleFormat();
     m_asbd = cautil::buildASBDForPCM(asbd.mSampleRate, asbd.mChannelsPerFrame,
                                      32, kAudioFormatFlagIsFloat);
     m_buffer.set_unit(asbd.mChannelsPerFrame);
+    unsigned lookahead = m_attack * asbd.mSampleRate + .5;
+    size_t size = 2;
+    while (size < lookahead + 2)
+        size <<= 1;
+    m_window.resize(size);
     if (m_statfile.get()) {
         AudioStreamBasicDescription asbd =
             cautil::buildASBDForPCM(m_asbd.mSampleRate, 1,
@@ -43,11 +148,18 @@ Compressor::Compressor(const std::shared_ptr<ISource> &src,
     }
 }
 
+Compressor::~Compressor()
+{
+    try {
+        flushStat();
+    } catch (...) {}
+}
+
 size_t Compressor::readSamples(void *buffer, size_t nsamples)
 {
     const double Fs = m_asbd.mSampleRate;
     unsigned nchannels = m_asbd.mChannelsPerFrame;
-    const double alphaA = 
+    const double alphaA =
         m_attack > 0.0 ? std::exp(-1.0 / (m_attack * Fs)) : 0.0;
     const double alphaR =
         m_release > 0.0 ? std::exp(-1.0 / (m_release * Fs)) : 0.0;
@@ -70,23 +182,30 @@ size_t Compressor::readSamples(void *buffer, size_t nsamples)
     nsamples = std::min(nsamples, m_buffer.count() - lookahead);
     float *data = m_buffer.read(nsamples);
 
-    if (m_statbuf.size() < nsamples)
-        m_statbuf.resize(nsamples);
-
+    if (m_gain.size() < nsamples)
+        m_gain.resize(nsamples);
+    float *gain = m_gain.data();
+    for (size_t i = 0; i < nsamples; ++i)
+        gain[i] = getPeakValue(data, i, nchannels, lookahead);
+    /*
+     * Only the smoothing depends on the previous frame. Level detection
+     * and conversion back to linear scale are done over the whole block.
+     */
+    transform<fast_log2>(gain, nsamples);
     for (size_t i = 0; i < nsamples; ++i) {
-        float xL = getPeakValue(data, i, nchannels, lookahead);
-        double xG = util::scale_to_dB(xL);
+        double xG = gain[i] * DB_PER_OCTAVE;
         double yG = computeGain(xG);
         double cG = smoothAverage(yG, alphaA, alphaR);
-        float cL = static_cast<float>(util::dB_to_scale(cG));
-        for (unsigned n = 0; n < nchannels; ++n)
-            data[i * nchannels + n] *= cL;
-        m_statbuf[i] = cL;
+        gain[i] = cG / DB_PER_OCTAVE;
     }
+    transform<fast_exp2>(gain, nsamples);
+    apply_gain(data, gain, nsamples, nchannels);
     memcpy(buffer, data, nsamples * bpf);
+
     if (m_statsink.get()) {
-        m_statsink->writeSamples(m_statbuf.data(), nsamples * sizeof(float),
-                                 nsamples);
+        m_statbuf.insert(m_statbuf.end(), gain, gain + nsamples);
+        if (m_statbuf.size() >= STAT_BLOCK || nsamples == 0)
+            flushStat();
         if (nsamples == 0)
             m_statsink->finishWrite();
     }
@@ -99,20 +218,25 @@ float Compressor::getPeakValue(const float *data, unsigned i,
 {
     if (!lookahead)
         return frame_amplitude(&data[i * nchannels], nchannels);
-    if (m_window.empty()) {
-        for (unsigned k = 0; k < lookahead; ++k) {
-            float x = frame_amplitude(&data[k * nchannels], nchannels);
-            while (!m_window.empty() && x >= m_window.back().second)
-                m_window.pop_back();
-            m_window.push_back(std::make_pair((int64_t)k, x));
-        }
+    size_t mask = m_window.size() - 1;
+    if (m_head == m_tail) {
+        for (unsigned k = 0; k < lookahead; ++k)
+            pushPeak(k, frame_amplitude(&data[k * nchannels], nchannels));
     }
-    float res = m_window.front().second;
-    while (!m_window.empty() && m_window.front().first <= m_position + i)
-        m_window.pop_front();
-    float x = frame_amplitude(&data[(i + lookahead) * nchannels], nchannels);
-    while (!m_window.empty() && x >= m_window.back().second)
-        m_window.pop_back();
-    m_window.push_back(std::make_pair(m_position + i + lookahead, x));
+    float res = m_window[m_head & mask].second;
+    while (m_head != m_tail && m_window[m_head & mask].first <= m_position + i)
+        ++m_head;
+    pushPeak(m_position + i + lookahead,
+             frame_amplitude(&data[(i + lookahead) * nchannels], nchannels));
     return res;
 }
+
+void Compressor::flushStat()
+{
+    if (!m_statsink.get() || m_statbuf.empty())
+        return;
+    m_statsink->writeSamples(m_statbuf.data(),
+                             m_statbuf.size() * sizeof(float),
+                             m_statbuf.size());
+    m_statbuf.clear();
+}
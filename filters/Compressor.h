@@ -1,7 +1,6 @@
 #ifndef COMPRESSOR_H
 #define COMPRESSOR_H
 
-#include <deque>
 #include "FilterBase.h"
 #include "util.h"
 #include "WaveSink.h"
@@ -22,16 +21,23 @@ class Compressor: public FilterBase {
     int64_t m_position;
     std::vector<uint8_t > m_pivot;
     util::FIFO<float> m_buffer;
-    std::deque<std::pair<int64_t, float>> m_window;
+    std::vector<float> m_gain;
+    /*
+     * monotonic queue of (position, peak) for the lookahead maximum,
+     * a ring of power of two size which holds the whole window
+     */
+    std::vector<std::pair<int64_t, float> > m_window;
+    size_t m_head, m_tail;
     AudioStreamBasicDescription m_asbd;
     std::shared_ptr<FILE> m_statfile;
     std::shared_ptr<WaveSink> m_statsink;
-    std::vector<float> m_statbuf;
+    std::vector<float> m_statbuf; /* gains not written to m_statsink yet */
 public:
     Compressor(const std::shared_ptr<ISource> &src,
                double threshold, double ratio, double knee_width,
                double attack, double release,
                std::shared_ptr<FILE> statfp);
+    ~Compressor();
     const AudioStreamBasicDescription &getSampleFormat() const
     {
         return m_asbd;
@@ -40,6 +46,14 @@ public:
 private:
     float getPeakValue(const float *data, unsigned i, unsigned nchannels,
                        unsigned lookahead);
+    void pushPeak(int64_t pos, float x)
+    {
+        size_t mask = m_window.size() - 1;
+        while (m_tail != m_head && x >= m_window[(m_tail - 1) & mask].second)
+            --m_tail;
+        m_window[m_tail++ & mask] = std::make_pair(pos, x);
+    }
+    void flushStat();
     /*
      * gain computer, works on log domain
      */
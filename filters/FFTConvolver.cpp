@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <stdexcept>
+#include "FFTConvolver.h"
+#include "simd.h"
+
+using namespace simd;
+
+namespace {
+    /* one stage of radix-2 butterflies, m of them per group */
+    void butterflies(float *re, float *im, size_t n, size_t m,
+                     const float *wr, const float *wi)
+    {
+        for (size_t k = 0; k < n; k += 2 * m) {
+            float *ar = re + k, *ai = im + k, *br = ar + m, *bi = ai + m;
+            size_t j = 0;
+            for (; j + 4 <= m; j += 4) {
+                v4sf xr = load(br + j), xi = load(bi + j);
+                v4sf cr = load(wr + j), ci = load(wi + j);
+                v4sf tr = cr * xr - ci * xi;
+                v4sf ti = cr * xi + ci * xr;
+                v4sf yr = load(ar + j), yi = load(ai + j);
+                store(br + j, yr - tr);
+                store(bi + j, yi - ti);
+                store(ar + j, yr + tr);
+                store(ai + j, yi + ti);
+            }
+            for (; j < m; ++j) {
+                float tr = wr[j] * br[j] - wi[j] * bi[j];
+                float ti = wr[j] * bi[j] + wi[j] * br[j];
+                br[j] = ar[j] - tr;
+                bi[j] = ai[j] - ti;
+                ar[j] += tr;
+                ai[j] += ti;
+            }
+        }
+    }
+}
+
+FFTConvolver::FFTConvolver(const std::vector<double> &coefs,
+                           unsigned nchannels)
+    : m_nchannels(nchannels),
+      m_ntaps(coefs.size()),
+      m_fill(0)
+{
+    if (!m_ntaps || !nchannels)
+        throw std::runtime_error("FFTConvolver: empty filter");
+    /* blocks of 3/4 of the transform at least, to keep the overhead low */
+    unsigned log2n = 10;
+    while ((size_t(1) << log2n) < 4 * m_ntaps)
+        ++log2n;
+    m_size = size_t(1) << log2n;
+    m_block = m_size - m_ntaps + 1;
+
+    m_bitrev.resize(m_size);
+    for (size_t i = 0; i < m_size; ++i) {
+        uint32_t r = 0;
+        for (unsigned b = 0; b < log2n; ++b)
+            r |= ((i >> b) & 1) << (log2n - 1 - b);
+        m_bitrev[i] = r;
+    }
+    m_twre.resize(m_size);
+    m_twim.resize(m_size);
+    for (size_t m = 1; m < m_size; m <<= 1) {
+        for (size_t j = 0; j < m; ++j) {
+            double w = -M_PI * j / m;
+            m_twre[m - 1 + j] = std::cos(w);
+            m_twim[m - 1 + j] = std::sin(w);
+        }
+    }
+
+    m_re.resize(m_size);
+    m_im.resize(m_size);
+    for (size_t i = 0; i < m_ntaps; ++i)
+        m_re[i] = coefs[i] / m_size;
+    fft(m_re.data(), m_im.data(), m_size);
+    m_hre = m_re;
+    m_him = m_im;
+
+    m_input.assign(m_size * nchannels, 0.0f);
+    m_output.assign(m_block * nchannels, 0.0f);
+}
+
+void FFTConvolver::process(const float * const *in, float * const *out,
+                           size_t n)
+{
+    for (size_t done = 0; done < n; ) {
+        size_t count = std::min(n - done, m_block - m_fill);
+        for (unsigned c = 0; c < m_nchannels; ++c) {
+            float *ip = &m_input[c * m_size + m_ntaps - 1 + m_fill];
+            const float *op = &m_output[c * m_block + m_fill];
+            std::memcpy(ip, in[c] + done, count * sizeof(float));
+            std::memcpy(out[c] + done, op, count * sizeof(float));
+        }
+        done += count;
+        if ((m_fill += count) == m_block) {
+            convolveBlock();
+            m_fill = 0;
+        }
+    }
+}
+
+void FFTConvolver::convolveBlock()
+{
+    const size_t history = m_ntaps - 1;
+    for (unsigned c = 0; c < m_nchannels; c += 2) {
+        float *a = &m_input[c * m_size];
+        if (c + 1 == m_nchannels) {
+            convolveReal(a, &m_output[c * m_block]);
+            break;
+        }
+        float *b = a + m_size;
+        std::copy(a, a + m_size, m_re.begin());
+        std::copy(b, b + m_size, m_im.begin());
+        fft(m_re.data(), m_im.data(), m_size);
+        /*
+         * multiply by the spectrum of the filter, then transform back:
+         * the inverse is the forward transform with re and im swapped
+         */
+        for (size_t i = 0; i < m_size; i += 4) {
+            v4sf xr = load(&m_re[i]), xi = load(&m_im[i]);
+            v4sf hr = load(&m_hre[i]), hi = load(&m_him[i]);
+            store(&m_im[i], xr * hr - xi * hi);
+            store(&m_re[i], xr * hi + xi * hr);
+        }
+        fft(m_re.data(), m_im.data(), m_size);
+        /* the first m_ntaps - 1 outputs are wrapped around; drop them */
+        std::copy(m_im.begin() + history, m_im.end(),
+                  m_output.begin() + c * m_block);
+        std::copy(m_re.begin() + history, m_re.end(),
+                  m_output.begin() + (c + 1) * m_block);
+    }
+    for (unsigned c = 0; c < m_nchannels; ++c) {
+        float *p = &m_input[c * m_size];
+        std::memmove(p, p + m_block, history * sizeof(float));
+    }
+}
+
+/*
+ * Convolves a block of a single channel x into y (m_block samples), by
+ * transforming even samples as the real part and odd ones as the
+ * imaginary part of an FFT of half the size, and separating the two
+ * halves of the spectrum afterwards; the inverse is the same backwards.
+ */
+void FFTConvolver::convolveReal(const float *x, float *y)
+{
+    typedef std::complex<float> complex_t;
+    const complex_t I(0.0f, 1.0f);
+    const size_t M = m_size / 2, history = m_ntaps - 1;
+    float *re = m_re.data(), *im = m_im.data();
+    for (size_t k = 0; k < M; ++k) {
+        re[k] = x[2 * k];
+        im[k] = x[2 * k + 1];
+    }
+    fft(re, im, M);
+    /* bins k and M - k only depend on each other; bin M is bin 0 */
+    for (size_t k = 0; k <= M / 2; ++k) {
+        size_t j = M - k;
+        complex_t zk(re[k], im[k]), zj(re[j % M], im[j % M]);
+        /* exp(-2 pi i k / N), from the last stage's twiddles */
+        complex_t wk(m_twre[M - 1 + k], m_twim[M - 1 + k]);
+        complex_t wj = -std::conj(wk);
+        complex_t xk = 0.5f * (zk + std::conj(zj))
+                     - 0.5f * I * wk * (zk - std::conj(zj));
+        complex_t xj = 0.5f * (zj + std::conj(zk))
+                     - 0.5f * I * wj * (zj - std::conj(zk));
+        complex_t yk = xk * complex_t(m_hre[k], m_him[k]);
+        complex_t yj = xj * complex_t(m_hre[j], m_him[j]);
+        /*
+         * Packed for the inverse, doubled to make up for its half size,
+         * and stored with re and im swapped as in convolveBlock()
+         */
+        complex_t vk = (yk + std::conj(yj))
+                     + I * std::conj(wk) * (yk - std::conj(yj));
+        complex_t vj = (yj + std::conj(yk))
+                     + I * std::conj(wj) * (yj - std::conj(yk));
+        re[k] = vk.imag();
+        im[k] = vk.real();
+        if (j < M) {
+            re[j] = vj.imag();
+            im[j] = vj.real();
+        }
+    }
+    fft(re, im, M);
+    /* the first m_ntaps - 1 outputs are wrapped around; drop them */
+    for (size_t t = history; t < m_size; ++t)
+        y[t - history] = t & 1 ? re[t / 2] : im[t / 2];
+}
+
+/* n is m_size, or a smaller power of two */
+void FFTConvolver::fft(float *re, float *im, size_t n)
+{
+    unsigned shift = 0;
+    while ((n << shift) < m_size)
+        ++shift;
+    for (size_t i = 0; i < n; ++i) {
+        size_t j = m_bitrev[i] >> shift;
+        if (i < j) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+    for (size_t m = 1; m < n; m <<= 1)
+        butterflies(re, im, n, m, &m_twre[m - 1], &m_twim[m - 1]);
+}
@@ -0,0 +1,40 @@
+#ifndef FFTCONVOLVER_H
+#define FFTCONVOLVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * FIR filter by overlap-save fast convolution, on planar float channels.
+ *
+ * Input is taken in blocks of latency() samples, so output sample t is
+ * the filter output for input time t - latency(); the delay of the filter
+ * itself comes on top of that. Channels are transformed two at a time,
+ * one as the real part and the other as the imaginary part; an odd one
+ * out goes through a real FFT (a half size complex one) instead.
+ */
+class FFTConvolver {
+    unsigned m_nchannels;
+    size_t m_ntaps;
+    size_t m_size; /* FFT length, a power of two */
+    size_t m_block; /* m_size - m_ntaps + 1 */
+    size_t m_fill; /* samples taken into the current block */
+    std::vector<uint32_t> m_bitrev;
+    std::vector<float> m_twre, m_twim; /* per stage, stage m from m - 1 */
+    std::vector<float> m_hre, m_him; /* filter spectrum, scaled by 1/N */
+    std::vector<float> m_input; /* per channel, m_size */
+    std::vector<float> m_output; /* per channel, m_block */
+    std::vector<float> m_re, m_im;
+public:
+    FFTConvolver(const std::vector<double> &coefs, unsigned nchannels);
+    size_t latency() const { return m_block; }
+    /* in and out may be the same */
+    void process(const float * const *in, float * const *out, size_t n);
+private:
+    void convolveBlock();
+    void convolveReal(const float *x, float *y);
+    void fft(float *re, float *im, size_t n);
+};
+
+#endif
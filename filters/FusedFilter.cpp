@@ -0,0 +1,267 @@
+#include <cmath>
+#include <type_traits>
+#include "FusedFilter.h"
+#include "cautil.h"
+#include "ChannelMapper.h"
+#include "Scaler.h"
+#include "Quantizer.h"
+
+namespace {
+    enum SampleType { OTHER, INT32, FLOAT32, FLOAT64 };
+
+    SampleType sample_type(const AudioStreamBasicDescription &asbd)
+    {
+        unsigned bpc = asbd.mBytesPerFrame / asbd.mChannelsPerFrame;
+        if (asbd.mFormatFlags & kAudioFormatFlagIsFloat)
+            return bpc == 4 ? FLOAT32 : bpc == 8 ? FLOAT64 : OTHER;
+        if (asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger)
+            return bpc == 4 ? INT32 : OTHER;
+        return OTHER;
+    }
+
+    /* what a run of stages adds up to, so far */
+    struct Fusion {
+        SampleType in, mid, out;
+        std::vector<uint32_t> chanmap;
+        bool gain;
+        double scale;
+        bool quantized;
+        unsigned bits;
+
+        explicit Fusion(const AudioStreamBasicDescription &asbd)
+            : gain(false), scale(1.0), quantized(false), bits(0)
+        {
+            in = mid = out = sample_type(asbd);
+            for (unsigned i = 0; i < asbd.mChannelsPerFrame; ++i)
+                chanmap.push_back(i);
+        }
+        bool permutes() const
+        {
+            for (size_t i = 0; i < chanmap.size(); ++i)
+                if (chanmap[i] != i)
+                    return true;
+            return false;
+        }
+        /* takes in stage, unless it can't be done in the same pass */
+        bool add(ISource *stage)
+        {
+            if (in == OTHER)
+                return false;
+            if (ChannelMapper *mapper = dynamic_cast<ChannelMapper*>(stage)) {
+                const std::vector<uint32_t> &map = mapper->chanmap();
+                std::vector<uint32_t> composed(map.size());
+                for (size_t i = 0; i < map.size(); ++i)
+                    composed[i] = chanmap[map[i]];
+                chanmap.swap(composed);
+                return true;
+            }
+            if (Scaler *scaler = dynamic_cast<Scaler*>(stage)) {
+                /* one rounding of the product only */
+                if (gain || quantized)
+                    return false;
+                mid = out = sample_type(scaler->getSampleFormat());
+                gain = true;
+                scale = scaler->scale();
+                return true;
+            }
+            if (Quantizer *quantizer = dynamic_cast<Quantizer*>(stage)) {
+                if (quantized)
+                    return false;
+                const AudioStreamBasicDescription &ofmt =
+                    quantizer->getSampleFormat();
+                const AudioStreamBasicDescription &ifmt =
+                    quantizer->source()->getSampleFormat();
+                if (ofmt.mFormatFlags & kAudioFormatFlagIsFloat)
+                    out = FLOAT32;
+                else if (out == INT32) {
+                    /* passes through unless bits are dropped */
+                    if (ofmt.mBitsPerChannel < ifmt.mBitsPerChannel)
+                        return false;
+                } else if (!quantizer->isDithering()) {
+                    out = INT32;
+                    bits = ofmt.mBitsPerChannel;
+                } else
+                    return false;
+                quantized = true;
+                return true;
+            }
+            return false;
+        }
+    };
+
+    template <typename T>
+    inline T clip(T x, T min, T max)
+    {
+        if (x > max) x = max;
+        else if (x < min) x = min;
+        return x;
+    }
+
+    /* same as readSamplesAsFloat() and Quantizer, for each pair of types */
+    template <typename To, typename From>
+    inline To convert(From x, double half, int shifts)
+    {
+        if constexpr (std::is_same_v<To, From>) {
+            return x;
+        } else if constexpr (std::is_integral_v<From>) {
+            return x / static_cast<To>(2147483648.0);
+        } else if constexpr (std::is_integral_v<To>) {
+            double value = x * half;
+            return lrint(clip(value, -half, half - 1)) << shifts;
+        } else if constexpr (sizeof(To) < sizeof(From)) {
+            const float anti_denormal = 1.0e-30f;
+            float y = static_cast<float>(x);
+            y += anti_denormal;
+            y -= anti_denormal;
+            return y;
+        } else {
+            return x;
+        }
+    }
+}
+
+size_t FusedFilter::optimize(std::vector<std::shared_ptr<ISource> > &chain)
+{
+    size_t removed = 0;
+    for (size_t i = 1; i < chain.size(); ++i) {
+        FilterBase *head = dynamic_cast<FilterBase*>(chain[i].get());
+        if (!head || head->sourcePtr() != chain[i-1])
+            continue;
+        Fusion fusion(chain[i-1]->getSampleFormat());
+        size_t end = i;
+        for (; end < chain.size(); ++end) {
+            FilterBase *stage = dynamic_cast<FilterBase*>(chain[end].get());
+            if (!stage || stage->sourcePtr() != chain[end-1]
+                || !fusion.add(stage))
+                break;
+        }
+        if (end - i < 2)
+            continue;
+        FilterBase *next = 0;
+        if (end < chain.size()) {
+            next = dynamic_cast<FilterBase*>(chain[end].get());
+            if (!next || next->sourcePtr() != chain[end-1])
+                continue;
+        }
+        std::vector<std::shared_ptr<ISource> >
+            run(chain.begin() + i, chain.begin() + end);
+        std::shared_ptr<ISource> fused = std::make_shared<FusedFilter>(run);
+        if (next)
+            next->setSource(fused);
+        chain.erase(chain.begin() + i + 1, chain.begin() + end);
+        chain[i] = fused;
+        removed += end - i - 1;
+    }
+    return removed;
+}
+
+FusedFilter::FusedFilter(const std::vector<std::shared_ptr<ISource> > &stages)
+    : FilterBase(dynamic_cast<FilterBase*>(stages[0].get())->sourcePtr()),
+      m_has_layout(false),
+      m_half(0.0),
+      m_shifts(0)
+{
+    Fusion fusion(source()->getSampleFormat());
+    for (size_t i = 0; i < stages.size(); ++i)
+        if (!fusion.add(stages[i].get()))
+            throw std::runtime_error("FusedFilter: BUG");
+
+    const ISource *last = stages.back().get();
+    m_asbd = last->getSampleFormat();
+    const std::vector<uint32_t> *layout = last->getChannels();
+    if (layout) {
+        m_layout = *layout;
+        m_has_layout = true;
+    }
+    m_chanmap = fusion.chanmap;
+    m_scale = fusion.scale;
+    if (fusion.bits) {
+        m_half = static_cast<double>(1U << (fusion.bits - 1));
+        m_shifts = 32 - fusion.bits;
+    }
+    bool permute = fusion.permutes();
+    switch (fusion.in) {
+    case INT32:
+        select<int32_t>(fusion.mid, fusion.out, fusion.gain, permute); break;
+    case FLOAT32:
+        select<float>(fusion.mid, fusion.out, fusion.gain, permute); break;
+    default:
+        select<double>(fusion.mid, fusion.out, fusion.gain, permute); break;
+    }
+}
+
+template <typename In>
+void FusedFilter::select(int mid, int out, bool gain, bool permute)
+{
+    switch (mid) {
+    case INT32:
+        select<In, int32_t>(out, gain, permute); break;
+    case FLOAT32:
+        select<In, float>(out, gain, permute); break;
+    default:
+        select<In, double>(out, gain, permute); break;
+    }
+}
+
+template <typename In, typename Mid>
+void FusedFilter::select(int out, bool gain, bool permute)
+{
+    switch (out) {
+    case INT32:
+        select<In, Mid, int32_t>(gain, permute); break;
+    case FLOAT32:
+        select<In, Mid, float>(gain, permute); break;
+    default:
+        select<In, Mid, double>(gain, permute); break;
+    }
+}
+
+template <typename In, typename Mid, typename Out>
+void FusedFilter::select(bool gain, bool permute)
+{
+    if (gain)
+        m_process = permute ? &FusedFilter::processT<In, Mid, Out, true, true>
+                            : &FusedFilter::processT<In, Mid, Out, true, false>;
+    else
+        m_process = permute ? &FusedFilter::processT<In, Mid, Out, false, true>
+                            : &FusedFilter::processT<In, Mid, Out, false, false>;
+}
+
+template <typename Mid, typename Out, bool Gain, typename In>
+inline Out FusedFilter::sample(In x) const
+{
+    Mid y = convert<Mid>(x, m_half, m_shifts);
+    if (Gain)
+        y = y * m_scale;
+    return convert<Out>(y, m_half, m_shifts);
+}
+
+template <typename In, typename Mid, typename Out, bool Gain, bool Permute>
+size_t FusedFilter::processT(void *buffer, size_t nsamples)
+{
+    unsigned nchannels = m_asbd.mChannelsPerFrame;
+    Out *op = static_cast<Out*>(buffer);
+    const In *ip;
+    if (sizeof(In) == sizeof(Out) && !Permute) {
+        /* element i is read before it's overwritten, so go in place */
+        nsamples = source()->readSamples(buffer, nsamples);
+        ip = static_cast<const In*>(buffer);
+    } else {
+        const void *data;
+        nsamples = borrowSamples(source(), &m_pivot, &data, nsamples);
+        ip = static_cast<const In*>(data);
+    }
+    if (!Permute) {
+        for (size_t i = 0; i < nsamples * nchannels; ++i)
+            op[i] = sample<Mid, Out, Gain>(ip[i]);
+    } else {
+        const uint32_t *chanmap = m_chanmap.data();
+        for (size_t i = 0; i < nsamples; ++i) {
+            for (unsigned n = 0; n < nchannels; ++n)
+                op[n] = sample<Mid, Out, Gain>(ip[chanmap[n]]);
+            ip += nchannels;
+            op += nchannels;
+        }
+    }
+    return nsamples;
+}
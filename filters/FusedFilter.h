@@ -0,0 +1,55 @@
+#ifndef FUSEDFILTER_H
+#define FUSEDFILTER_H
+
+#include "FilterBase.h"
+
+/*
+ * Does the work of a run of per-sample stages (ChannelMapper, Scaler,
+ * and Quantizer when it doesn't dither) in a single pass: each sample is
+ * converted, moved to its channel, scaled and rounded on its way to the
+ * caller's buffer, with the same arithmetic the stages would have used.
+ */
+class FusedFilter: public FilterBase {
+    AudioStreamBasicDescription m_asbd;
+    std::vector<uint32_t> m_layout;
+    bool m_has_layout;
+    std::vector<uint32_t> m_chanmap; /* output channel n is input m_chanmap[n] */
+    double m_scale;
+    double m_half; /* 2^(bits - 1), when rounding to integers */
+    int m_shifts;
+    std::vector<uint8_t> m_pivot;
+    size_t (FusedFilter::*m_process)(void *, size_t);
+public:
+    /*
+     * Replaces each run of two or more stages of chain that can be fused.
+     * Returns the number of stages removed.
+     */
+    static size_t optimize(std::vector<std::shared_ptr<ISource> > &chain);
+
+    explicit FusedFilter(const std::vector<std::shared_ptr<ISource> > &stages);
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_asbd;
+    }
+    const std::vector<uint32_t> *getChannels() const
+    {
+        return m_has_layout ? &m_layout : 0;
+    }
+    size_t readSamples(void *buffer, size_t nsamples)
+    {
+        return (this->*m_process)(buffer, nsamples);
+    }
+private:
+    template <typename In, typename Mid, typename Out, bool Gain, bool Permute>
+    size_t processT(void *buffer, size_t nsamples);
+    template <typename Mid, typename Out, bool Gain, typename In>
+    Out sample(In x) const;
+    template <typename In, typename Mid, typename Out>
+    void select(bool gain, bool permute);
+    template <typename In, typename Mid>
+    void select(int out, bool gain, bool permute);
+    template <typename In>
+    void select(int mid, int out, bool gain, bool permute);
+};
+
+#endif
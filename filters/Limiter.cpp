@@ -1,81 +1,206 @@
+#include <algorithm>
+#include <cmath>
 #include "Limiter.h"
+#include "simd.h"
+
+using namespace simd;
 
 namespace {
     template <typename T> T clip(T x, T low, T high)
     {
         return std::max(low, std::min(high, x));
     }
+
+    /* first i in [begin, end) with |x[i]| > thresh, or end */
+    size_t find_peak(const float *x, size_t begin, size_t end, float thresh)
+    {
+        v4sf hi = v4sf{} + thresh, lo = v4sf{} - thresh;
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            v4sf a = load(x + i), b = load(x + i + 4);
+            v4si m = (a > hi) | (a < lo) | (b > hi) | (b < lo);
+            if (m[0] | m[1] | m[2] | m[3])
+                break;
+        }
+        for (; i < end; ++i)
+            if (x[i] > thresh || x[i] < -thresh)
+                break;
+        return i;
+    }
+
+    /*
+     * x + a * x * x (+ b * x * x * x), evaluated in the same order as the
+     * scalar form so that the result does not depend on the alignment.
+     */
+    void shape(float *x, size_t n, float a)
+    {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            v4sf v = load(x + i);
+            store(x + i, v + a * v * v);
+        }
+        for (; i < n; ++i)
+            x[i] = x[i] + a * x[i] * x[i];
+    }
+
+    void shape(float *x, size_t n, float a, float b)
+    {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            v4sf v = load(x + i);
+            store(x + i, v + b * v * v + a * v * v * v);
+        }
+        for (; i < n; ++i)
+            x[i] = x[i] + b * x[i] * x[i] + a * x[i] * x[i] * x[i];
+    }
 }
 
-void SoftClipper::process(const float *in, size_t nin, float *out, size_t *nout)
+void SoftClipper::process(const float * const *in, size_t nin,
+                          float * const *out, size_t *nout)
 {
+    reserve(m_write - m_read + nin);
+    size_t size = m_write - m_read + nin;
+
     for (int n = 0; n < m_nchannels; ++n) {
-        std::vector<float> &x = m_buffer[n];
-        x.reserve(x.size() + nin);
+        float *x = pending(n);
+        size_t processed = m_processed[n] - m_read;
+        float *xp = x + (m_write - m_read);
         for (size_t i = 0; i < nin; ++i)
-            x.push_back(clip(in[i * m_nchannels + n],
-                             -3.0f * m_thresh, 3.0f * m_thresh));
+            xp[i] = clip(in[n][i], -3.0f * m_thresh, 3.0f * m_thresh);
 
-        ssize_t limit = x.size();
+        size_t limit = size;
         if (limit > 0 && nin > 0) {
             float last = x[limit-1];
             for (; limit > 0 && x[limit-1] * last > 0; --limit)
                 ;
         }
-        ssize_t end = m_processed[n];
-        while (end < limit) {
-            ssize_t peak_pos = end;
-            for (; peak_pos < limit; ++peak_pos)
-                if (x[peak_pos] > m_thresh || x[peak_pos] < -m_thresh)
-                    break;
-            if (peak_pos == limit)
+        clipHalfWaves(x, processed, limit);
+        m_processed[n] = m_read + limit;
+        mirror(n, x + processed, size - processed);
+    }
+    m_write += nin;
+
+    size_t prod = *nout;
+    for (int n = 0; n < m_nchannels; ++n)
+        prod = std::min(prod, static_cast<size_t>(m_processed[n] - m_read));
+    for (int n = 0; n < m_nchannels; ++n)
+        std::memcpy(out[n], pending(n), prod * sizeof(float));
+    m_read += prod;
+    *nout = prod;
+}
+
+void SoftClipper::reserve(size_t n)
+{
+    if (m_capacity && n <= m_capacity)
+        return;
+    size_t capacity = std::max(m_capacity, static_cast<size_t>(4096));
+    while (capacity < n)
+        capacity <<= 1;
+    std::vector<float> buffer(2 * m_nchannels * capacity);
+    size_t count = m_write - m_read;
+    size_t offset = m_read & (capacity - 1);
+    for (int c = 0; c < m_nchannels; ++c) {
+        float *bp = &buffer[2 * c * capacity + offset];
+        if (count)
+            std::memcpy(bp, pending(c), count * sizeof(float));
+    }
+    m_buffer.swap(buffer);
+    m_capacity = capacity;
+    for (int c = 0; c < m_nchannels; ++c)
+        mirror(c, pending(c), count);
+}
+
+/* copy [p, p + count) of channel n to the other half of the ring */
+void SoftClipper::mirror(int n, const float *p, size_t count)
+{
+    float *base = &m_buffer[2 * n * m_capacity];
+    size_t off = p - base;
+    if (off < m_capacity) {
+        size_t len = std::min(count, m_capacity - off);
+        std::memcpy(base + off + m_capacity, p, len * sizeof(float));
+        p += len;
+        off += len;
+        count -= len;
+    }
+    if (count)
+        std::memcpy(base + off - m_capacity, p, count * sizeof(float));
+}
+
+void SoftClipper::clipHalfWaves(float *x, size_t end, size_t limit)
+{
+    while (end < limit) {
+        size_t peak_pos = find_peak(x, end, limit, m_thresh);
+        if (peak_pos == limit)
+            break;
+        size_t start = peak_pos;
+        float peak = std::abs(x[peak_pos]);
+
+        while (start > end && x[peak_pos] * x[start] >= 0)
+            --start;
+        ++start;
+        for (end = peak_pos + 1; end < limit; ++end) {
+            if (x[peak_pos] * x[end] < 0)
                 break;
-            ssize_t start = peak_pos;
-            float peak = std::abs(x[peak_pos]);
-
-            while (start > end && x[peak_pos] * x[start] >= 0)
-                --start;
-            ++start;
-            for (end = peak_pos + 1; end < limit; ++end) {
-                if (x[peak_pos] * x[end] < 0)
-                    break;
-                float y = std::abs(x[end]);
-                if (y > peak) {
-                    peak = y;
-                    peak_pos = end;
-                }
-            }
-            if (peak < m_thresh * 2.0) {
-                float a = (peak - m_thresh) / (peak * peak);
-                if (x[peak_pos] > 0) a = - a;
-                for (ssize_t i = start; i < end; ++i)
-                    x[i] = x[i] + a * x[i] * x[i];
-            } else {
-                float u = peak, v = m_thresh;
-                float a = (u - 2 * v) / (u * u * u);
-                float b = (3 * v - 2 * u) / (u * u);
-                if (x[peak_pos] < 0)
-                    b *= -1.0;
-                for (ssize_t i = start; i < end; ++i)
-                    x[i] = x[i] + b * x[i] * x[i] + a * x[i] * x[i] * x[i];
+            float y = std::abs(x[end]);
+            if (y > peak) {
+                peak = y;
+                peak_pos = end;
             }
         }
-        m_processed[n] = limit;
+        if (peak < m_thresh * 2.0) {
+            float a = (peak - m_thresh) / (peak * peak);
+            if (x[peak_pos] > 0) a = - a;
+            shape(x + start, end - start, a);
+        } else {
+            float u = peak, v = m_thresh;
+            float a = (u - 2 * v) / (u * u * u);
+            float b = (3 * v - 2 * u) / (u * u);
+            if (x[peak_pos] < 0)
+                b *= -1.0;
+            shape(x + start, end - start, a, b);
+        }
     }
-    size_t prod = std::min(*nout, *std::min_element(m_processed.begin(),
-                                                    m_processed.end()));
-    size_t k = 0;
-    for (size_t i = 0; i < prod; ++i)
-        for (int n = 0; n < m_nchannels; ++n)
-            out[k++] = m_buffer[n][i];
+}
 
-    for (int n = 0; n < m_nchannels; ++n) {
-        std::vector<float> &x = m_buffer[n];
-        if (x.size() && prod) {
-            std::rotate(x.begin(), x.begin() + prod, x.end());
-            x.resize(x.size() - prod);
-            m_processed[n] -= prod;
+size_t Limiter::readSamples(void *buffer, size_t nsamples)
+{
+    unsigned nch = m_asbd.mChannelsPerFrame;
+    reserve(nsamples);
+    for (unsigned n = 0; n < nch; ++n)
+        m_out[n] = m_fbuffer.data() + (nch + n) * nsamples;
+    nsamples = readPlanar(m_out.data(), nsamples);
+    float *bp = static_cast<float*>(buffer);
+    if (nch == 1) {
+        std::memcpy(bp, m_out[0], nsamples * sizeof(float));
+    } else {
+        for (unsigned n = 0; n < nch; ++n) {
+            const float *x = m_out[n];
+            float *op = bp + n;
+            for (size_t i = 0; i < nsamples; ++i, op += nch)
+                *op = x[i];
         }
     }
-    *nout = prod;
+    return nsamples;
+}
+
+size_t Limiter::readPlanar(float * const *channels, size_t nsamples)
+{
+    unsigned nch = m_asbd.mChannelsPerFrame;
+    reserve(nsamples);
+    for (unsigned n = 0; n < nch; ++n)
+        m_in[n] = m_fbuffer.data() + n * nsamples;
+    size_t nin, nout;
+    do {
+        nin = readSamplesPlanar(source(), &m_ibuffer, m_in.data(), nsamples);
+        nout = nsamples;
+        m_clipper.process(m_in.data(), nin, channels, &nout);
+    } while (nin > 0 && nout == 0);
+    return nout;
+}
+
+/* room for nsamples of planar input, and as much output */
+void Limiter::reserve(size_t nsamples)
+{
+    if (m_fbuffer.size() < 2 * nsamples * m_asbd.mChannelsPerFrame)
+        m_fbuffer.resize(2 * nsamples * m_asbd.mChannelsPerFrame);
 }
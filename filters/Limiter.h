@@ -3,25 +3,42 @@
 #include "FilterBase.h"
 #include "cautil.h"
 
+/*
+ * Keeps pending input in planar ring buffers whose capacity is a power of
+ * two. Every sample is stored twice, at i and i + capacity, so whatever is
+ * pending is always contiguous and can be scanned as a plain array.
+ */
 class SoftClipper {
     int m_nchannels;
     float m_thresh;
-    std::vector<std::vector<float> > m_buffer;
-    std::vector<size_t> m_processed;
+    size_t m_capacity;
+    uint64_t m_read, m_write; /* counts of samples output / taken in */
+    std::vector<uint64_t> m_processed;
+    std::vector<float> m_buffer;
 public:
     explicit SoftClipper(int nchannels, float threshold=0.9921875f)
-        : m_nchannels(nchannels), m_thresh(threshold)
+        : m_nchannels(nchannels), m_thresh(threshold), m_capacity(0),
+          m_read(0), m_write(0), m_processed(nchannels)
+    {}
+    /* in and out are planar; *nout is the room in out on entry */
+    void process(const float * const *in, size_t nin,
+                 float * const *out, size_t *nout);
+private:
+    /* the pending samples of channel n, from m_read on */
+    float *pending(int n)
     {
-        m_buffer.resize(nchannels);
-        m_processed.resize(nchannels);
+        return &m_buffer[2 * n * m_capacity + (m_read & (m_capacity - 1))];
     }
-    void process(const float *in, size_t nin, float *out, size_t *nout);
+    void reserve(size_t n);
+    void mirror(int n, const float *p, size_t count);
+    void clipHalfWaves(float *x, size_t end, size_t limit);
 };
 
-class Limiter: public FilterBase {
+class Limiter: public FilterBase, public IPlanarSource {
     SoftClipper m_clipper;
     std::vector<uint8_t> m_ibuffer;
-    std::vector<float>   m_fbuffer;
+    std::vector<float>   m_fbuffer; /* planar input, then planar output */
+    std::vector<float*>  m_in, m_out;
     AudioStreamBasicDescription m_asbd;
 public:
     Limiter(const std::shared_ptr<ISource> &source)
@@ -32,24 +49,16 @@ public:
         m_asbd = cautil::buildASBDForPCM(asbd.mSampleRate,
                                          asbd.mChannelsPerFrame, 32,
                                          kAudioFormatFlagIsFloat);
+        m_in.resize(asbd.mChannelsPerFrame);
+        m_out.resize(asbd.mChannelsPerFrame);
     }
     const AudioStreamBasicDescription &getSampleFormat() const
     {
         return m_asbd;
     }
-    size_t readSamples(void *buffer, size_t nsamples)
-    {
-        if (m_fbuffer.size() < nsamples * m_asbd.mChannelsPerFrame)
-            m_fbuffer.resize(nsamples * m_asbd.mChannelsPerFrame);
-        size_t nin, nout;
-        do {
-            nin = readSamplesAsFloat(source(), &m_ibuffer, m_fbuffer.data(),
-                                     nsamples);
-            nout = nsamples;
-            m_clipper.process(m_fbuffer.data(), nin,
-                              static_cast<float*>(buffer), &nout);
-        } while (nin > 0 && nout == 0);
-        return nout;
-    }
+    size_t readSamples(void *buffer, size_t nsamples);
+    size_t readPlanar(float * const *channels, size_t nsamples);
+private:
+    void reserve(size_t nsamples);
 };
 
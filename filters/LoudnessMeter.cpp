@@ -0,0 +1,181 @@
+#include <cmath>
+#include <algorithm>
+#include "LoudnessMeter.h"
+
+namespace {
+    const unsigned TAPS = 12; /* per phase of the 4x oversampler */
+
+    double bessel_i0(double x)
+    {
+        double sum = 1.0, term = 1.0, q = x * x / 4.0;
+        for (int k = 1; term > sum * 1e-21; ++k) {
+            term *= q / (k * k);
+            sum += term;
+        }
+        return sum;
+    }
+
+    /* phases 1..3 of 4x oversampling, phase 0 being the sample itself */
+    struct Interpolator {
+        float coefs[3][TAPS];
+        Interpolator()
+        {
+            const double beta = 6.0, half = TAPS / 2;
+            for (unsigned p = 1; p < 4; ++p) {
+                for (unsigned j = 0; j < TAPS; ++j) {
+                    double t = p / 4.0 + half - 1 - j;
+                    double x = t / half;
+                    double w = bessel_i0(beta * std::sqrt(1 - x * x))
+                             / bessel_i0(beta);
+                    coefs[p - 1][j] = std::sin(M_PI * t) / (M_PI * t) * w;
+                }
+            }
+        }
+    };
+
+    const Interpolator &interpolator()
+    {
+        static Interpolator self;
+        return self;
+    }
+
+    /* 1: L, R, C..., 1.41: surrounds, 0: LFE */
+    double channel_weight(uint32_t label)
+    {
+        switch (label) {
+        case 4:
+            return 0.0;
+        case 5: case 6: case 10: case 11: case 33: case 34:
+            return 1.41;
+        }
+        return 1.0;
+    }
+
+    double block_loudness(double z)
+    {
+        return -0.691 + 10.0 * std::log10(z);
+    }
+}
+
+LoudnessMeter::LoudnessMeter(const AudioStreamBasicDescription &asbd,
+                             const std::vector<uint32_t> *channels)
+    : m_nchannels(asbd.mChannelsPerFrame),
+      m_peak(0.0),
+      m_true_peak(0.0),
+      m_filled(0),
+      m_energy(0.0)
+{
+    /* K-weighting: high shelf, then high pass, for any sample rate */
+    double fs = asbd.mSampleRate;
+    double K = std::tan(M_PI * 1681.974450955533 / fs);
+    double Q = 0.7071752369554196;
+    double Vh = std::pow(10.0, 3.999843853973347 / 20.0);
+    double Vb = std::pow(Vh, 0.4996667741545416);
+    double a0 = 1.0 + K / Q + K * K;
+    m_shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+    m_shelf.b1 = 2.0 * (K * K - Vh) / a0;
+    m_shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+    m_shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+    m_shelf.a2 = (1.0 - K / Q + K * K) / a0;
+
+    K = std::tan(M_PI * 38.13547087602444 / fs);
+    Q = 0.5003270373238773;
+    a0 = 1.0 + K / Q + K * K;
+    m_highpass.b0 = 1.0;
+    m_highpass.b1 = -2.0;
+    m_highpass.b2 = 1.0;
+    m_highpass.a1 = 2.0 * (K * K - 1.0) / a0;
+    m_highpass.a2 = (1.0 - K / Q + K * K) / a0;
+
+    m_weights.assign(m_nchannels, 1.0);
+    if (channels && channels->size() == m_nchannels)
+        for (unsigned c = 0; c < m_nchannels; ++c)
+            m_weights[c] = channel_weight(channels->at(c));
+    m_state.assign(m_nchannels * 4, 0.0);
+    m_history.assign(m_nchannels * (TAPS - 1), 0.0f);
+    m_step = std::max(1L, std::lrint(fs / 10.0));
+}
+
+template <typename T>
+void LoudnessMeter::process(const T *data, size_t nframes)
+{
+    for (size_t i = 0; i < nframes; ++i) {
+        const T *frame = data + i * m_nchannels;
+        double energy = 0.0;
+        for (unsigned c = 0; c < m_nchannels; ++c) {
+            double x = frame[c];
+            double *s = &m_state[c * 4];
+            m_peak = std::max(m_peak, std::abs(x));
+
+            double y = m_shelf.b0 * x + s[0];
+            s[0] = m_shelf.b1 * x - m_shelf.a1 * y + s[1];
+            s[1] = m_shelf.b2 * x - m_shelf.a2 * y;
+            x = y;
+            y = m_highpass.b0 * x + s[2];
+            s[2] = m_highpass.b1 * x - m_highpass.a1 * y + s[3];
+            s[3] = m_highpass.b2 * x - m_highpass.a2 * y;
+            energy += m_weights[c] * y * y;
+        }
+        m_energy += energy;
+        if (++m_filled == m_step) {
+            m_steps.push_back(m_energy / m_step);
+            m_energy = 0.0;
+            m_filled = 0;
+        }
+    }
+    m_work.resize(TAPS - 1 + nframes);
+    for (unsigned c = 0; c < m_nchannels; ++c) {
+        float *history = &m_history[c * (TAPS - 1)];
+        std::copy(history, history + TAPS - 1, m_work.begin());
+        for (size_t i = 0; i < nframes; ++i)
+            m_work[TAPS - 1 + i] = data[i * m_nchannels + c];
+        oversample(m_work.data(), nframes);
+        std::copy(m_work.end() - (TAPS - 1), m_work.end(), history);
+    }
+}
+
+template void LoudnessMeter::process<float>(const float *, size_t);
+template void LoudnessMeter::process<double>(const double *, size_t);
+
+double LoudnessMeter::loudness() const
+{
+    std::vector<double> blocks;
+    for (size_t i = 3; i < m_steps.size(); ++i)
+        blocks.push_back((m_steps[i-3] + m_steps[i-2]
+                          + m_steps[i-1] + m_steps[i]) / 4.0);
+
+    double gate = std::pow(10.0, (-70.0 + 0.691) / 10.0);
+    for (int pass = 0; pass < 2; ++pass) {
+        double sum = 0.0;
+        size_t count = 0;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (blocks[i] > gate) {
+                sum += blocks[i];
+                ++count;
+            }
+        }
+        if (!count)
+            return -HUGE_VAL;
+        if (pass == 1)
+            return block_loudness(sum / count);
+        /* relative gate, 10LU below the loudness of the above */
+        gate = std::max(gate, sum / count * 0.1);
+    }
+    return -HUGE_VAL;
+}
+
+void LoudnessMeter::oversample(const float *x, size_t n)
+{
+    const Interpolator &ip = interpolator();
+    float peak = m_true_peak;
+    for (size_t i = 0; i < n; ++i) {
+        const float *w = x + i;
+        for (unsigned p = 0; p < 3; ++p) {
+            float y = 0.0f;
+            for (unsigned j = 0; j < TAPS; ++j)
+                y += ip.coefs[p][j] * w[j];
+            peak = std::max(peak, std::abs(y));
+        }
+    }
+    m_true_peak = std::max(static_cast<double>(peak), m_peak);
+}
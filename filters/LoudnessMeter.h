@@ -0,0 +1,44 @@
+#ifndef LOUDNESSMETER_H
+#define LOUDNESSMETER_H
+
+#include <vector>
+#include <cstdint>
+#include "CoreAudio/CoreAudioTypes.h"
+
+/*
+ * Sample peak, true peak and integrated loudness (ITU-R BS.1770) of
+ * whatever is fed to process().
+ *
+ * True peak is taken from 4x oversampling with a 48 tap windowed sinc.
+ * Loudness is measured on 400ms blocks with 75% overlap, gated at -70LUFS
+ * and then at -10LU relative. Surround channels are weighted by 1.41 and
+ * LFE is left out, when the channel layout is known.
+ */
+class LoudnessMeter {
+    struct Biquad {
+        double b0, b1, b2, a1, a2;
+    };
+    unsigned m_nchannels;
+    Biquad m_shelf, m_highpass;
+    std::vector<double> m_weights;
+    std::vector<double> m_state; /* 4 per channel, for the two biquads */
+    std::vector<float> m_history; /* last TAPS - 1 samples, per channel */
+    std::vector<float> m_work;
+    double m_peak, m_true_peak;
+    uint32_t m_step; /* samples per 100ms */
+    uint32_t m_filled;
+    double m_energy; /* weighted sum of squares of the current 100ms */
+    std::vector<double> m_steps; /* energy of each 100ms so far */
+public:
+    LoudnessMeter(const AudioStreamBasicDescription &asbd,
+                  const std::vector<uint32_t> *channels);
+    template <typename T> void process(const T *data, size_t nframes);
+    double peak() const { return m_peak; }
+    double truePeak() const { return m_true_peak; }
+    /* in LUFS, -HUGE_VAL when everything is below the absolute gate */
+    double loudness() const;
+private:
+    void oversample(const float *x, size_t n);
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "LowpassFilter.h"
+#include "cautil.h"
+
+namespace {
+    const double ATTENUATION = 120.0;
+
+    double bessel_i0(double x)
+    {
+        double sum = 1.0, term = 1.0, q = x * x / 4.0;
+        for (int k = 1; term > sum * 1e-21; ++k) {
+            term *= q / (k * k);
+            sum += term;
+        }
+        return sum;
+    }
+}
+
+LowpassFilter::LowpassFilter(const std::shared_ptr<ISource> &src,
+                             unsigned Fp, unsigned nthreads)
+    : FilterBase(src), m_position(0), m_work(0), m_nwork(0)
+{
+    const AudioStreamBasicDescription &asbd = src->getSampleFormat();
+    unsigned nch = asbd.mChannelsPerFrame;
+    m_asbd = cautil::buildASBDForPCM(asbd.mSampleRate, nch,
+                                     32, kAudioFormatFlagIsFloat);
+
+    /* same transition band as libsoxconvolver was given */
+    double Fs = Fp + asbd.mSampleRate * TRANSITION;
+    if (Fp == 0 || Fp > maxCutoff(asbd.mSampleRate))
+        throw std::runtime_error("LowpassFilter: invalid cut-off frequency");
+    std::vector<double> coefs = design(Fp, Fs, asbd.mSampleRate);
+    m_ntaps = coefs.size();
+
+    for (unsigned c = 0; c < nch; c += 2)
+        m_filters.push_back(std::make_shared<FFTConvolver>(coefs,
+                                                std::min(2U, nch - c)));
+    m_skip = m_flush = m_filters[0]->latency() + m_ntaps / 2;
+    m_planes.resize(nch);
+
+    nthreads = std::min(nthreads, static_cast<unsigned>(m_filters.size()));
+    m_pool = std::make_shared<WorkerPool>(nthreads,
+                                          [this](unsigned n, unsigned step) {
+                                              filterChannels(n, step);
+                                          });
+}
+
+/* windowed sinc, cut off halfway between Fp and Fs, odd length */
+std::vector<double> LowpassFilter::design(double Fp, double Fs, double rate)
+{
+    double dw = 2.0 * M_PI * (Fs - Fp) / rate;
+    unsigned ntaps = std::ceil((ATTENUATION - 8.0) / (2.285 * dw)) + 1;
+    ntaps |= 1;
+    double beta = 0.1102 * (ATTENUATION - 8.7);
+    double fc = (Fp + Fs) / rate; /* twice the normalized cut-off */
+    unsigned origin = ntaps / 2;
+
+    std::vector<double> coefs(ntaps);
+    double norm = 1.0 / bessel_i0(beta), sum = 0.0;
+    for (unsigned i = 0; i < ntaps; ++i) {
+        double t = static_cast<double>(i) - origin;
+        double x = t / origin;
+        double sinc = t ? std::sin(M_PI * fc * t) / (M_PI * t) : fc;
+        coefs[i] = sinc * bessel_i0(beta * std::sqrt(1.0 - x * x)) * norm;
+        sum += coefs[i];
+    }
+    for (unsigned i = 0; i < ntaps; ++i)
+        coefs[i] /= sum;
+    return coefs;
+}
+
+size_t LowpassFilter::readSamples(void *buffer, size_t nsamples)
+{
+    unsigned nch = m_asbd.mChannelsPerFrame;
+    if (m_fbuffer.size() < nsamples * nch) {
+        m_fbuffer.resize(nsamples * nch);
+        for (unsigned c = 0; c < nch; ++c)
+            m_planes[c] = &m_fbuffer[c * nsamples];
+    }
+    nsamples = readPlanar(m_planes.data(), nsamples);
+    float *op = static_cast<float*>(buffer);
+    for (size_t i = 0; i < nsamples; ++i)
+        for (unsigned c = 0; c < nch; ++c)
+            *op++ = m_planes[c][i];
+    return nsamples;
+}
+
+size_t LowpassFilter::readPlanar(float * const *channels, size_t nsamples)
+{
+    size_t n, skip;
+    do {
+        n = fill(channels, nsamples);
+        skip = std::min(m_skip, n);
+        m_skip -= skip;
+    } while (n && n == skip);
+    if (skip) {
+        for (unsigned c = 0; c < m_asbd.mChannelsPerFrame; ++c)
+            std::memmove(channels[c], channels[c] + skip,
+                         (n - skip) * sizeof(float));
+    }
+    m_position += n - skip;
+    return n - skip;
+}
+
+/* input or, after the end of it, silence, filtered in place */
+size_t LowpassFilter::fill(float * const *channels, size_t nsamples)
+{
+    size_t n = readSamplesPlanar(source(), &m_pivot, channels, nsamples);
+    if (!n && m_flush) {
+        n = std::min(nsamples, m_flush);
+        m_flush -= n;
+        for (unsigned c = 0; c < m_asbd.mChannelsPerFrame; ++c)
+            std::fill(channels[c], channels[c] + n, 0.0f);
+    }
+    if (!n)
+        return 0;
+
+    m_work = channels;
+    m_nwork = n;
+    m_pool->run();
+    return n;
+}
+
+void LowpassFilter::filterChannels(unsigned first, unsigned step)
+{
+    for (unsigned i = first; i < m_filters.size(); i += step)
+        m_filters[i]->process(m_work + 2 * i, m_work + 2 * i, m_nwork);
+}
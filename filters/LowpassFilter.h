@@ -0,0 +1,52 @@
+#ifndef LOWPASSFILTER_H
+#define LOWPASSFILTER_H
+
+#include "FilterBase.h"
+#include "FFTConvolver.h"
+#include "WorkerPool.h"
+
+/*
+ * Linear phase FIR low-pass (Kaiser window, 120dB stopband), applied by
+ * FFTConvolver. The delay of the filter and of the convolver is cut from
+ * the start and made up with silence at the end, so output is aligned
+ * with input and has the same length.
+ *
+ * Output is float32, interleaved or planar. Pairs of channels are
+ * filtered separately, and can be split across threads.
+ */
+class LowpassFilter: public FilterBase, public IPlanarSource {
+    static constexpr double TRANSITION = 0.0125; /* relative to the rate */
+    int64_t m_position;
+    unsigned m_ntaps;
+    std::vector<std::shared_ptr<FFTConvolver> > m_filters; /* per pair */
+    size_t m_skip; /* samples of delay left to cut from the start */
+    size_t m_flush; /* samples of silence left to push through at the end */
+    std::vector<uint8_t> m_pivot;
+    std::vector<float> m_fbuffer; /* planar, for readSamples() */
+    std::vector<float*> m_planes;
+    AudioStreamBasicDescription m_asbd;
+
+    /* the job the pool is running */
+    float * const *m_work;
+    size_t m_nwork;
+    std::shared_ptr<WorkerPool> m_pool;
+public:
+    LowpassFilter(const std::shared_ptr<ISource> &src, unsigned Fp,
+                  unsigned nthreads=1);
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_asbd;
+    }
+    int64_t getPosition() { return m_position; }
+    size_t readSamples(void *buffer, size_t nsamples);
+    size_t readPlanar(float * const *channels, size_t nsamples);
+    unsigned taps() const { return m_ntaps; }
+    /* the transition band has to fit below Nyquist */
+    static double maxCutoff(double rate) { return rate * (0.5 - TRANSITION); }
+private:
+    std::vector<double> design(double Fp, double Fs, double rate);
+    size_t fill(float * const *channels, size_t nsamples);
+    void filterChannels(unsigned first, unsigned step);
+};
+
+#endif
@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <cstring>
 #include "MatrixMixer.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include "cautil.h"
+#include "simd.h"
+
+using namespace simd;
 
 static bool validateMatrix(const std::vector<std::vector<misc::complex_t>> &mat,
                            uint32_t *nshifts)
@@ -74,31 +79,55 @@ static double calcGain(double *coefs, size_t numcoefs)
     return gain;
 }
 
+/* y += k * x */
+static void accumulate(float *y, const float *x, float k, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        store(y + i, load(y + i) + load(x + i) * k);
+    for (; i < n; ++i)
+        y[i] += x[i] * k;
+}
+
 MatrixMixer::MatrixMixer(const std::shared_ptr<ISource> &source,
                          const std::vector<std::vector<complex_t> > &spec,
                          bool normalize)
     : FilterBase(source),
       m_position(0),
-      m_matrix(spec),
-      m_module(SoXConvolverModule::instance())
+      m_skip(0),
+      m_flush(0)
 {
     const AudioStreamBasicDescription &fmt = source->getSampleFormat();
+    std::vector<std::vector<complex_t> > matrix(spec);
     uint32_t shiftMask;
-    if (!validateMatrix(m_matrix, &shiftMask))
+    if (!validateMatrix(matrix, &shiftMask))
         throw std::runtime_error("invalid/unsupported matrix spec");
-    if (m_matrix[0].size() != fmt.mChannelsPerFrame)
+    if (matrix[0].size() != fmt.mChannelsPerFrame)
         throw std::runtime_error("unmatch number of channels with matrix");
     if (normalize)
-        normalizeMatrix(m_matrix);
+        normalizeMatrix(matrix);
+    m_ichannels = fmt.mChannelsPerFrame;
     m_asbd = cautil::buildASBDForPCM(fmt.mSampleRate, spec.size(),
                                      32, kAudioFormatFlagIsFloat);
-    m_buffer.set_unit(fmt.mChannelsPerFrame);
-    for (unsigned i = 0; i < fmt.mChannelsPerFrame; ++i) {
+    /* phase shifted inputs have only the imaginary part */
+    m_matrix.resize(matrix.size());
+    for (size_t out = 0; out < matrix.size(); ++out) {
+        for (unsigned in = 0; in < m_ichannels; ++in) {
+            complex_t factor = matrix[out][in];
+            float k = factor.real() + factor.imag();
+            if (k != 0.0f)
+                m_matrix[out].push_back(std::make_pair(in, k));
+        }
+    }
+    for (unsigned i = 0; i < m_ichannels; ++i) {
         if (shiftMask & (1 << i))
             m_shift_channels.push_back(i);
         else
             m_pass_channels.push_back(i);
     }
+    m_planes.resize(m_ichannels);
+    m_shift_planes.resize(m_shift_channels.size());
+    m_pass_planes.resize(m_pass_channels.size());
     if (shiftMask)
         initFilter();
 }
@@ -116,90 +145,96 @@ void MatrixMixer::initFilter()
          ii != coefs.end(); ++ii)
         *ii /= filter_gain;
 
-    for (unsigned i = 0; i < m_shift_channels.size(); ++i) {
-        lsx_convolver_t *f =
-            m_module.create(1, &coefs[0], coefs.size(), coefs.size()>>1);
-        if (!f)
-            throw std::runtime_error("failed to init hilbert transformer");
-        std::shared_ptr<lsx_convolver_t> filterp(f, m_module.close);
-        m_filter.push_back(filterp);
-    }
+    m_filter = std::make_shared<FFTConvolver>(coefs,
+                                              m_shift_channels.size());
+    size_t delay = m_filter->latency() + (numtaps >> 1);
+    if (m_pass_channels.size())
+        m_delay = std::make_shared<DelayLine>(m_pass_channels.size(), delay);
+    m_skip = m_flush = delay;
 }
 
 size_t MatrixMixer::readSamples(void *buffer, size_t nsamples)
 {
-    uint32_t ichannels = source()->getSampleFormat().mChannelsPerFrame;
-    if (m_fbuffer.size() < nsamples * ichannels)
-        m_fbuffer.resize(nsamples * ichannels);
+    reserve(nsamples);
+    size_t n, skip;
+    do {
+        n = fill(nsamples);
+        skip = std::min(m_skip, n);
+        m_skip -= skip;
+    } while (n && n == skip);
+    mix(skip, n - skip, static_cast<float*>(buffer));
+    m_position += n - skip;
+    return n - skip;
+}
 
-    if (m_shift_channels.size())
-        nsamples = phaseShift(nsamples);
-    else
-        nsamples = readSamplesAsFloat(source(), &m_ibuffer,
-                                      &m_fbuffer[0], nsamples);
+void MatrixMixer::reserve(size_t nsamples)
+{
+    if (m_fbuffer.size() >= nsamples * m_ichannels)
+        return;
+    m_fbuffer.resize(nsamples * m_ichannels);
+    for (unsigned i = 0; i < m_ichannels; ++i)
+        m_planes[i] = &m_fbuffer[i * nsamples];
+    for (size_t i = 0; i < m_shift_channels.size(); ++i)
+        m_shift_planes[i] = m_planes[m_shift_channels[i]];
+    for (size_t i = 0; i < m_pass_channels.size(); ++i)
+        m_pass_planes[i] = m_planes[m_pass_channels[i]];
+}
 
-    float *op = static_cast<float*>(buffer);
-    for (size_t i = 0; i < nsamples; ++i) {
-        float *ip = &m_fbuffer[i * ichannels];
-        for (size_t out = 0; out < m_asbd.mChannelsPerFrame; ++out) {
-            float value = 0.0f;
-            for (size_t in = 0; in < ichannels; ++in) {
-                complex_t factor = m_matrix[out][in];
-                value += ip[in] * (factor.real() + factor.imag());
-            }
-            *op++ = value;
-        }
+/* planar input, phase shifted and delayed, in m_planes */
+size_t MatrixMixer::fill(size_t nsamples)
+{
+    size_t n = readSamplesPlanar(source(), &m_ibuffer, m_planes.data(),
+                                 nsamples);
+    if (!n && m_flush) {
+        n = std::min(nsamples, m_flush);
+        m_flush -= n;
+        for (unsigned i = 0; i < m_ichannels; ++i)
+            std::fill(m_planes[i], m_planes[i] + n, 0.0f);
+    }
+    if (n && m_filter) {
+        m_filter->process(m_shift_planes.data(), m_shift_planes.data(), n);
+        if (m_delay)
+            m_delay->process(m_pass_planes.data(), n);
     }
-    m_position += nsamples;
-    return nsamples;
+    return n;
 }
 
-size_t MatrixMixer::phaseShift(size_t nsamples)
+/*
+ * Output channels one at a time, over blocks of frames small enough for
+ * the sums to stay in cache until they are interleaved.
+ */
+void MatrixMixer::mix(size_t offset, size_t nsamples, float *buffer)
 {
-    const uint32_t ichannels = source()->getSampleFormat().mChannelsPerFrame;
-    const size_t pass_channels_size = m_pass_channels.size();
-    const size_t shift_channels_size = m_shift_channels.size();
-    const unsigned * const pass_channels =
-        pass_channels_size ? &m_pass_channels[0]: 0;
-    const unsigned * const shift_channels = &m_shift_channels[0];
-
-    size_t ilen = 0, olen = 0;
-    do {
-        if (m_buffer.count() == 0) {
-            m_buffer.reserve(nsamples);
-            ilen = readSamplesAsFloat(source(), &m_ibuffer,
-                                      m_buffer.write_ptr(), nsamples);
-            m_buffer.commit(ilen);
-            if (pass_channels_size > 0) {
-                for (size_t i = 0; i < ilen; ++i) {
-                    float *frame = m_buffer.read_ptr() + i * ichannels;
-                    for (unsigned n = 0; n < pass_channels_size; ++n)
-                        m_syncque.push_back(frame[pass_channels[n]]);
-                }
-            }
+    const size_t block = 256;
+    float acc[block];
+    unsigned nchannels = m_asbd.mChannelsPerFrame;
+    for (size_t base = 0; base < nsamples; base += block) {
+        size_t count = std::min(block, nsamples - base);
+        for (unsigned out = 0; out < nchannels; ++out) {
+            std::fill(acc, acc + count, 0.0f);
+            const std::vector<std::pair<unsigned, float> > &row =
+                m_matrix[out];
+            for (size_t k = 0; k < row.size(); ++k)
+                accumulate(acc, m_planes[row[k].first] + offset + base,
+                           row[k].second, count);
+            float *op = buffer + base * nchannels + out;
+            for (size_t i = 0; i < count; ++i)
+                op[i * nchannels] = acc[i];
         }
-        float *bp = m_buffer.read_ptr();
-        for (unsigned i = 0; i < shift_channels_size; ++i) {
-            unsigned n = shift_channels[i];
-            ilen = m_buffer.count();
-            olen = nsamples;
-            float *ip = bp + n;
-            float *op = &m_fbuffer[n];
-            m_module.process_ni(m_filter[i].get(), &ip, &op,
-                                ichannels, ichannels, &ilen, &olen);
-        }
-        m_buffer.advance(ilen);
-    } while (ilen != 0 && olen == 0);
+    }
+}
 
-    if (pass_channels_size > 0) {
-        float *fp = &m_fbuffer[0];
-        for (size_t i = 0; i < olen; ++i) {
-            float *frame = fp + i * ichannels;
-            for (unsigned n = 0; n < pass_channels_size; ++n) {
-                frame[pass_channels[n]] = m_syncque.front();
-                m_syncque.pop_front();
-            }
-        }
+void DelayLine::process(float * const *channels, size_t n)
+{
+    if (!m_delay)
+        return;
+    /* swap each sample with the one that came m_delay samples before */
+    for (size_t done = 0; done < n; ) {
+        size_t count = std::min(n - done, m_delay - m_index);
+        for (size_t c = 0; c < m_buffer.size(); ++c)
+            std::swap_ranges(channels[c] + done, channels[c] + done + count,
+                             m_buffer[c].begin() + m_index);
+        done += count;
+        m_index = (m_index + count) % m_delay;
     }
-    return olen;
 }
@@ -2,23 +2,43 @@
 #define MIXER_H
 
 #include <complex>
-#include <deque>
 #include "FilterBase.h"
-#include "SoxConvolverModule.h"
+#include "FFTConvolver.h"
 #include "misc.h"
 
+/* delays planar channels by a fixed number of samples, in place */
+class DelayLine {
+    size_t m_delay;
+    size_t m_index;
+    std::vector<std::vector<float> > m_buffer;
+public:
+    DelayLine(unsigned nchannels, size_t delay)
+        : m_delay(delay), m_index(0),
+          m_buffer(nchannels, std::vector<float>(delay))
+    {}
+    void process(float * const *channels, size_t n);
+};
+
+/*
+ * Channels with an imaginary coefficient go through a Hilbert transformer
+ * (90 degree phase shift); the others are delayed to stay in sync with
+ * them, and the delay is cut off from the start of the output.
+ */
 class MatrixMixer: public FilterBase {
     typedef misc::complex_t complex_t;
     int64_t m_position;
-    std::vector<std::vector<complex_t> > m_matrix;
-    std::vector<std::shared_ptr<lsx_convolver_t> > m_filter;
+    unsigned m_ichannels;
+    /* for each output channel, nonzero coefficients and their inputs */
+    std::vector<std::vector<std::pair<unsigned, float> > > m_matrix;
+    std::shared_ptr<FFTConvolver> m_filter;
+    std::shared_ptr<DelayLine> m_delay;
     std::vector<unsigned> m_shift_channels, m_pass_channels;
-    std::deque<float> m_syncque;
+    size_t m_skip; /* samples of delay left to cut from the start */
+    size_t m_flush; /* samples of silence left to push through at the end */
     std::vector<uint8_t> m_ibuffer;
-    std::vector<float> m_fbuffer;
-    util::FIFO<float> m_buffer;
+    std::vector<float> m_fbuffer; /* planar */
+    std::vector<float*> m_planes, m_shift_planes, m_pass_planes;
     AudioStreamBasicDescription m_asbd;
-    SoXConvolverModule &m_module;
 public:
     MatrixMixer(const std::shared_ptr<ISource> &source,
                 const std::vector<std::vector<complex_t> > &spec,
@@ -32,7 +52,9 @@ public:
     size_t readSamples(void *buffer, size_t nsamples);
 private:
     void initFilter();
-    size_t phaseShift(size_t nsamples);
+    void reserve(size_t nsamples);
+    size_t fill(size_t nsamples);
+    void mix(size_t offset, size_t nsamples, float *buffer);
 };
 
 #endif
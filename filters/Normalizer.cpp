@@ -1,16 +1,103 @@
 #include <cstdio>
+#include <algorithm>
 #include <cstring>
 #include <cmath>
 #include <float.h>
 #include "Normalizer.h"
-#ifdef _WIN32
 #include "win32util.h"
-#endif
 #include "cautil.h"
 
+namespace {
+    /* bytes a sample takes in the temporary file */
+    unsigned spill_width(const AudioStreamBasicDescription &asbd)
+    {
+        unsigned bpc = asbd.mBytesPerFrame / asbd.mChannelsPerFrame;
+        if (asbd.mFormatFlags & kAudioFormatFlagIsFloat)
+            return bpc;
+        return std::min(bpc, static_cast<unsigned>(asbd.mBitsPerChannel + 7) / 8);
+    }
+
+    /* passes samples through, appending them to fd */
+    class SpillWriter: public FilterBase {
+        int m_fd;
+        unsigned m_width;
+        uint64_t m_bytes;
+        std::vector<uint8_t> m_buffer;
+    public:
+        SpillWriter(const std::shared_ptr<ISource> &src, int fd)
+            : FilterBase(src), m_fd(fd), m_bytes(0)
+        {
+            m_width = spill_width(src->getSampleFormat());
+        }
+        size_t readSamples(void *buffer, size_t nsamples)
+        {
+            const AudioStreamBasicDescription &asbd = getSampleFormat();
+            unsigned bpc = asbd.mBytesPerFrame / asbd.mChannelsPerFrame;
+            nsamples = source()->readSamples(buffer, nsamples);
+            size_t size = nsamples * asbd.mBytesPerFrame;
+            const void *data = buffer;
+            if (m_width != bpc) {
+                m_buffer.assign(static_cast<uint8_t*>(buffer),
+                                static_cast<uint8_t*>(buffer) + size);
+                util::pack(m_buffer.data(), &size, bpc, m_width);
+                data = m_buffer.data();
+            }
+            m_bytes += size;
+            win32::tmpfile_reserve(m_fd, m_bytes);
+            CHECKCRT(write(m_fd, data, size) < 0);
+            return nsamples;
+        }
+    };
+
+    /* reads back what SpillWriter wrote, in the format of its source */
+    class SpillReader: public ISource {
+        int m_fd;
+        unsigned m_width;
+        uint64_t m_length;
+        int64_t m_position;
+        AudioStreamBasicDescription m_asbd;
+        std::vector<uint8_t> m_buffer;
+    public:
+        SpillReader(int fd, const AudioStreamBasicDescription &asbd,
+                    uint64_t length)
+            : m_fd(fd), m_length(length), m_position(0), m_asbd(asbd)
+        {
+            m_width = spill_width(asbd);
+        }
+        uint64_t length() const { return m_length; }
+        const AudioStreamBasicDescription &getSampleFormat() const
+        {
+            return m_asbd;
+        }
+        const std::vector<uint32_t> *getChannels() const { return 0; }
+        int64_t getPosition() { return m_position; }
+        size_t readSamples(void *buffer, size_t nsamples)
+        {
+            unsigned nc = m_asbd.mChannelsPerFrame;
+            unsigned bpc = m_asbd.mBytesPerFrame / nc;
+            size_t size = nsamples * nc * m_width;
+            void *data = m_width == bpc ? buffer : nullptr;
+            if (!data) {
+                if (m_buffer.size() < size)
+                    m_buffer.resize(size);
+                data = m_buffer.data();
+            }
+            ssize_t n = util::nread(m_fd, data, size);
+            if (n <= 0)
+                return 0;
+            nsamples = n / (nc * m_width);
+            size = nsamples * nc * m_width;
+            if (data != buffer)
+                util::unpack(data, buffer, &size, m_width, bpc);
+            m_position += nsamples;
+            return nsamples;
+        }
+    };
+}
+
 Normalizer::Normalizer(const std::shared_ptr<ISource> &src, bool seekable)
     : FilterBase(src),
-      m_peak(0.0),
+      m_meter(src->getSampleFormat(), src->getChannels()),
       m_processed(0),
       m_position(0)
 {
@@ -25,8 +112,8 @@ Normalizer::Normalizer(const std::shared_ptr<ISource> &src, bool seekable)
                                      asbd.mChannelsPerFrame,
                                      bits, kAudioFormatFlagIsFloat);
     if (!seekable) {
-        FILE *tmpfile = win32::tmpfile("qaac.norm");
-        m_tmpfile = std::shared_ptr<FILE>(tmpfile, std::fclose);
+        m_tmpfile = win32::tmpfile("qaac.norm");
+        m_spill = std::make_shared<SpillWriter>(src, fd());
     }
 }
 
@@ -52,33 +139,34 @@ size_t Normalizer::processT(size_t nsamples)
     if (m_fbuffer.size() < nsamples * m_asbd.mBytesPerFrame)
         m_fbuffer.resize(nsamples * m_asbd.mBytesPerFrame);
     T *bp = reinterpret_cast<T*>(&m_fbuffer[0]);
-    size_t nc = readSamplesAsFloat(source(), &m_ibuffer, bp, nsamples);
+    ISource *src = m_spill.get() ? m_spill.get() : source();
+    size_t nc = readSamplesAsFloat(src, &m_ibuffer, bp, nsamples);
     if (nc > 0) {
         m_processed += nc;
-        if (fd() > 0)
-            CHECKCRT(write(fd(), bp, nc * m_asbd.mBytesPerFrame) < 0);
-        for (size_t i = 0; i < nc * m_asbd.mChannelsPerFrame; ++i) {
-            double x = std::abs(bp[i]);
-            if (x > m_peak) m_peak = x;
-        }
-    } else if (fd() > 0)
+        m_meter.process(bp, nc);
+    } else if (fd() > 0 && !m_playback.get()) {
         CHECKCRT(lseek(fd(), 0, SEEK_SET) < 0);
+        m_playback = std::make_shared<SpillReader>(fd(),
+                                                   source()->getSampleFormat(),
+                                                   m_processed);
+        m_spill.reset();
+    }
     return nc;
 }
 
 template <typename T>
 size_t Normalizer::readSamplesT(void *buffer, size_t nsamples)
 {
-    if (!m_tmpfile.get())
+    if (!m_playback.get())
         return 0;
-    int nc = util::nread(fd(), buffer, nsamples * m_asbd.mBytesPerFrame);
     T *fp = static_cast<T*>(buffer);
-    if (m_peak > FLT_MIN) {
-        T peak = m_peak / 0.99609375;
-        for (size_t i = 0; i < nc / sizeof(T); ++i)
-            fp[i] = fp[i] / peak;
+    nsamples = readSamplesAsFloat(m_playback.get(), &m_ibuffer, fp, nsamples);
+    double peak = getPeak();
+    if (peak > FLT_MIN) {
+        T scale = peak / 0.99609375;
+        for (size_t i = 0; i < nsamples * m_asbd.mChannelsPerFrame; ++i)
+            fp[i] = fp[i] / scale;
     }
-    nsamples = std::max(0, static_cast<int>(nc/m_asbd.mBytesPerFrame));
     m_position += nsamples;
     return nsamples;
 }
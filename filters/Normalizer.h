@@ -2,12 +2,21 @@
 #define _NORMALIZE_H
 
 #include "FilterBase.h"
+#include "LoudnessMeter.h"
 
+/*
+ * process() scans the source, measuring peak, true peak and loudness.
+ * When the source is not seekable, the samples are also kept in a
+ * temporary file in their original format (integers packed to their
+ * significant bytes), and readSamples() plays them back normalized.
+ */
 class Normalizer: public FilterBase {
-    double m_peak;
+    LoudnessMeter m_meter;
     std::vector<uint8_t> m_ibuffer;
     std::vector<uint8_t> m_fbuffer;
     std::shared_ptr<FILE> m_tmpfile;
+    std::shared_ptr<ISource> m_spill; /* writes to m_tmpfile while scanning */
+    std::shared_ptr<ISource> m_playback; /* reads m_tmpfile */
     uint64_t m_processed, m_position;
     AudioStreamBasicDescription m_asbd;
 public:
@@ -17,7 +26,10 @@ public:
         return m_asbd;
     }
     size_t readSamples(void *buffer, size_t nsamples);
-    double getPeak() const { return m_peak; }
+    double getPeak() const { return m_meter.peak(); }
+    double getTruePeak() const { return m_meter.truePeak(); }
+    /* integrated loudness in LUFS */
+    double getLoudness() const { return m_meter.loudness(); }
     size_t process(size_t nsamples);
     int64_t getPosition() { return m_position; }
     uint64_t length() const { return m_processed; }
@@ -0,0 +1,216 @@
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include "PolyphaseResampler.h"
+#include "cautil.h"
+#include "simd.h"
+
+using namespace simd;
+
+namespace {
+    const size_t NSAMPLES = 0x1000;
+    const unsigned MAX_PHASES = 1024;
+
+    double bessel_i0(double x)
+    {
+        double sum = 1.0, term = 1.0, q = x * x / 4.0;
+        for (int k = 1; term > sum * 1e-21; ++k) {
+            term *= q / (k * k);
+            sum += term;
+        }
+        return sum;
+    }
+
+    /* n is a multiple of 8; pointers need not be aligned */
+    inline float dot(const float *x, const float *h, unsigned n)
+    {
+        v4sf a = { 0 }, b = { 0 };
+        for (unsigned i = 0; i < n; i += 8) {
+            a += load(x + i) * load(h + i);
+            b += load(x + i + 4) * load(h + i + 4);
+        }
+        a += b;
+        return (a[0] + a[2]) + (a[1] + a[3]);
+    }
+}
+
+PolyphaseResampler::PolyphaseResampler(const std::shared_ptr<ISource> &src,
+                                       unsigned rate, Quality quality,
+                                       unsigned nthreads)
+    : FilterBase(src), m_position(0), m_head(0), m_nread(0), m_eof(false),
+      m_stride(0), m_nout(0)
+{
+    /* passband (fraction of the lower Nyquist), attenuation in dB */
+    static const double presets[][2] = {
+        { 0.913, 120.0 }, /* HQ */
+        { 0.913, 140.0 }, /* VHQ: about as far as float32 goes */
+    };
+    const AudioStreamBasicDescription &asbd = src->getSampleFormat();
+    unsigned irate = std::lrint(asbd.mSampleRate);
+    if (!irate || !rate)
+        throw std::runtime_error("PolyphaseResampler: invalid sample rate");
+    unsigned g = std::gcd(irate, rate);
+    m_up = rate / g;
+    m_down = irate / g;
+    design(presets[quality][0], presets[quality][1]);
+
+    unsigned nch = asbd.mChannelsPerFrame;
+    m_asbd = cautil::buildASBDForPCM(rate, nch, 32, kAudioFormatFlagIsFloat);
+    /* what comes before the first sample is silence */
+    unsigned history = m_ntaps / 2 - 1;
+    m_input.assign(nch, std::vector<float>(history));
+    m_base = -static_cast<int64_t>(history);
+    m_planes.resize(nch);
+    m_out.resize(nch);
+
+    m_length = source()->length();
+    if (m_length != ~0ULL)
+        m_length = (m_length * m_up + m_down - 1) / m_down;
+
+    m_pool = std::make_shared<WorkerPool>(std::min(nthreads, nch),
+                                          [this](unsigned n, unsigned step) {
+                                              filterChannels(n, step);
+                                          });
+}
+
+size_t PolyphaseResampler::readSamples(void *buffer, size_t nsamples)
+{
+    unsigned nch = m_asbd.mChannelsPerFrame;
+    for (unsigned c = 0; c < nch; ++c)
+        m_out[c] = static_cast<float*>(buffer) + c;
+    m_stride = nch;
+    return generate(nsamples);
+}
+
+size_t PolyphaseResampler::readPlanar(float * const *channels, size_t nsamples)
+{
+    std::copy(channels, channels + m_asbd.mChannelsPerFrame, m_out.begin());
+    m_stride = 1;
+    return generate(nsamples);
+}
+
+size_t PolyphaseResampler::generate(size_t nsamples)
+{
+    if (m_length != ~0ULL)
+        nsamples = std::min(static_cast<uint64_t>(nsamples),
+                            m_length - m_position);
+    if (!nsamples)
+        return 0;
+    fill((m_position + nsamples - 1) * m_down / m_up + m_ntaps / 2);
+    /* length might have just been found out at the end of input */
+    nsamples = std::min(static_cast<uint64_t>(nsamples),
+                        m_length - m_position);
+    if (!nsamples)
+        return 0;
+
+    m_nout = nsamples;
+    m_pool->run();
+    m_position += nsamples;
+
+    /* drop input which is behind the window of the next output */
+    int64_t first = m_position * m_down / m_up - m_ntaps / 2 + 1;
+    size_t ndrop = std::min(static_cast<size_t>(std::max(first - m_base,
+                                                         int64_t(0))),
+                            m_input[0].size() - m_head);
+    m_head += ndrop;
+    m_base += ndrop;
+    return nsamples;
+}
+
+void PolyphaseResampler::design(double passband, double attenuation)
+{
+    /* frequencies are in cycles per input sample */
+    double fs = 0.5 * std::min(1.0, static_cast<double>(m_up) / m_down);
+    double fp = fs * passband;
+    double cutoff = (fp + fs) / 2.0;
+    double beta = 0.1102 * (attenuation - 8.7);
+    double width = 2.0 * M_PI * (fs - fp);
+    unsigned n = std::ceil((attenuation - 7.95) / (2.285 * width));
+    m_ntaps = std::max((n + 7) & ~7U, 8U);
+    m_nphases = std::min(m_up, MAX_PHASES);
+
+    /*
+     * Row p is for an output falling p / m_nphases past an input sample,
+     * tap j is applied to input sample (that one) - m_ntaps / 2 + 1 + j.
+     * The extra last row is only for interpolation between phases.
+     */
+    double half = m_ntaps / 2.0, norm = 1.0 / bessel_i0(beta);
+    m_coefs.resize((m_nphases + 1) * m_ntaps);
+    for (unsigned p = 0; p <= m_nphases; ++p) {
+        double frac = static_cast<double>(p) / m_nphases;
+        for (unsigned j = 0; j < m_ntaps; ++j) {
+            double t = frac + half - 1 - j;
+            double x = t / half;
+            double w = x * x < 1.0 ? bessel_i0(beta * std::sqrt(1 - x * x))
+                                   : 0.0;
+            double a = 2.0 * M_PI * cutoff * t;
+            double s = t == 0.0 ? 1.0 : std::sin(a) / a;
+            m_coefs[p * m_ntaps + j] = 2.0 * cutoff * s * w * norm;
+        }
+    }
+}
+
+void PolyphaseResampler::fill(int64_t last)
+{
+    unsigned nch = m_asbd.mChannelsPerFrame;
+    for (;;) {
+        size_t avail = m_input[0].size() - m_head;
+        if (m_base + static_cast<int64_t>(avail) > last)
+            break;
+        size_t n = 0;
+        if (!m_eof) {
+            /* cut off what was consumed, once it is worth a block */
+            if (m_head >= NSAMPLES) {
+                for (unsigned c = 0; c < nch; ++c)
+                    m_input[c].erase(m_input[c].begin(),
+                                     m_input[c].begin() + m_head);
+                m_head = 0;
+            }
+            size_t off = m_input[0].size();
+            for (unsigned c = 0; c < nch; ++c) {
+                m_input[c].resize(off + NSAMPLES);
+                m_planes[c] = m_input[c].data() + off;
+            }
+            n = readSamplesPlanar(source(), &m_pivot, m_planes.data(),
+                                  NSAMPLES);
+            for (unsigned c = 0; c < nch; ++c)
+                m_input[c].resize(off + n);
+            m_nread += n;
+            if (!n) {
+                m_eof = true;
+                m_length = (m_nread * m_up + m_down - 1) / m_down;
+            }
+        }
+        if (!n) {
+            /* what comes after the last sample is silence */
+            size_t pad = last + 1 - (m_base + avail);
+            for (unsigned c = 0; c < nch; ++c)
+                m_input[c].resize(m_input[c].size() + pad);
+        }
+    }
+}
+
+void PolyphaseResampler::filterChannels(unsigned first, unsigned step)
+{
+    unsigned nch = m_asbd.mChannelsPerFrame;
+    int64_t origin = m_base + m_ntaps / 2 - 1;
+    for (unsigned c = first; c < nch; c += step) {
+        const float *x = m_input[c].data() + m_head;
+        float *y = m_out[c];
+        for (size_t k = 0; k < m_nout; ++k, y += m_stride) {
+            uint64_t t = (m_position + k) * m_down;
+            const float *xp = x + (static_cast<int64_t>(t / m_up) - origin);
+            unsigned r = t % m_up;
+            if (m_nphases == m_up) {
+                *y = dot(xp, &m_coefs[r * m_ntaps], m_ntaps);
+            } else {
+                double pos = static_cast<double>(r) * m_nphases / m_up;
+                unsigned p = pos;
+                float w = pos - p;
+                float a = dot(xp, &m_coefs[p * m_ntaps], m_ntaps);
+                float b = dot(xp, &m_coefs[(p + 1) * m_ntaps], m_ntaps);
+                *y = a + w * (b - a);
+            }
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef POLYPHASERESAMPLER_H
+#define POLYPHASERESAMPLER_H
+
+#include "FilterBase.h"
+#include "WorkerPool.h"
+
+/*
+ * Windowed-sinc (Kaiser) sample rate converter, working on the exact
+ * rational ratio of the two rates. When the reduced ratio has too many
+ * phases, coefficients are linearly interpolated between table phases.
+ *
+ * The filter is centered on each output instant, so there is no delay to
+ * compensate for: output sample n is at input time n * irate / orate, and
+ * length() is exactly ceil(input length * orate / irate).
+ *
+ * Output is float32, interleaved or planar. Channels are filtered
+ * separately, and can be split across threads.
+ */
+class PolyphaseResampler: public FilterBase, public IPlanarSource {
+public:
+    /* passband and stopband attenuation roughly follow soxr's presets */
+    enum Quality { HQ, VHQ };
+private:
+    int64_t m_position;
+    uint64_t m_length;
+    unsigned m_up, m_down; /* orate / irate, reduced */
+    unsigned m_nphases; /* coefficient table phases, m_up at most */
+    unsigned m_ntaps;
+    std::vector<float> m_coefs; /* (m_nphases + 1) rows of m_ntaps */
+    /*
+     * input, one vector per channel. Consumed samples are skipped by
+     * m_head and only cut off once in a while; m_base is the index of
+     * the sample at m_head.
+     */
+    std::vector<std::vector<float> > m_input;
+    size_t m_head;
+    int64_t m_base;
+    uint64_t m_nread;
+    bool m_eof;
+    std::vector<uint8_t> m_pivot;
+    std::vector<float*> m_planes; /* where fill() reads input to */
+    AudioStreamBasicDescription m_asbd;
+
+    /* the job the pool is running; channel n goes to m_out[n] */
+    std::vector<float*> m_out;
+    size_t m_stride;
+    size_t m_nout;
+    std::shared_ptr<WorkerPool> m_pool;
+public:
+    PolyphaseResampler(const std::shared_ptr<ISource> &src, unsigned rate,
+                       Quality quality=HQ, unsigned nthreads=1);
+    uint64_t length() const { return m_length; }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_asbd;
+    }
+    int64_t getPosition() { return m_position; }
+    size_t readSamples(void *buffer, size_t nsamples);
+    size_t readPlanar(float * const *channels, size_t nsamples);
+    unsigned taps() const { return m_ntaps; }
+private:
+    void design(double passband, double attenuation);
+    void fill(int64_t last);
+    size_t generate(size_t nsamples);
+    void filterChannels(unsigned first, unsigned step);
+};
+
+#endif
@@ -1,44 +1,77 @@
+#include <cmath>
+#include <cstring>
 #include "Quantizer.h"
+#include "simd.h"
 
-template <typename T>
-inline T clip(T x, T min, T max)
-{
-    if (x > max) x = max;
-    else if (x < min) x = min;
-    return x;
-}
+using namespace simd;
+
+namespace {
+    /* error feedback filter, from Lipshitz et al. (1991) */
+    const unsigned NS_TAPS = 5;
+    const double ns_coefs[NS_TAPS] = {
+        2.033, -2.165, 1.959, -1.590, 0.6149
+    };
+    /* in LSBs; keeps the loop stable when the signal is clipped */
+    const double NS_MAX_ERROR = 2.0;
+
+    template <typename T>
+    inline T clip(T x, T min, T max)
+    {
+        if (x > max) x = max;
+        else if (x < min) x = min;
+        return x;
+    }
 
-/* inacculate, but much faster than std::uniform_int_distribution<> */
-template <typename Engine>
-class RandomIntSpan {
-    Engine &e_;
-    int div_, off_;
-public:
-    RandomIntSpan(Engine &e, int min, int max)
-        : e_(e), off_(min)
+    template <typename V> inline V vclip(V x, V min, V max)
     {
-        div_ = e.max() / (max - min);
-    }
-    int operator()() { return e_() / div_ + off_; }
-};
-
-template <typename Engine>
-class RandomIntSpanShift {
-    Engine &e_;
-    int shift_, off_;
-public:
-    RandomIntSpanShift(Engine &e, int log2)
-        : e_(e)
+        x = x > max ? max : x;
+        return x < min ? min : x;
+    }
+
+    template <typename V, typename T> inline V splat(T x) { return V{} + x; }
+
+    inline v2df load2(const float *p)
+    {
+        return __builtin_convertvector(load<v2sf>(p), v2df);
+    }
+
+    inline v2df load2(const double *p) { return load<v2df>(p); }
+
+    /* round half to even, as lrint() does; |x| must be below 2^51 */
+    inline v2si vrint(v2df x)
     {
-        shift_ = 32 - log2;
-        off_ = - (1 << (log2 - 1));
+        const v2df magic = splat<v2df>(0x1.8p52);
+        return __builtin_convertvector((x + magic) - magic, v2si);
     }
-    int operator()() { return (e_() >> shift_) + off_; }
-};
+
+    /* uniform in [-0.5, 0.5) */
+    inline double uniform(uint32_t r)
+    {
+        return r * 0x1p-32 - 0.5;
+    }
+
+    inline v2df uniform(v2su r)
+    {
+        return __builtin_convertvector(r, v2df) * 0x1p-32 - 0.5;
+    }
+
+    /* uniform in [0, 2^log2), offset to be centered */
+    inline int32_t noise_int(uint32_t r, int log2)
+    {
+        return static_cast<int32_t>(r >> (32 - log2)) - (1 << (log2 - 1));
+    }
+
+    inline v4si noise_int(v4su r, int log2)
+    {
+        return reinterpret_cast<v4si>(r >> (32 - log2)) - (1 << (log2 - 1));
+    }
+}
 
 Quantizer::Quantizer(const std::shared_ptr<ISource> &source,
-                     uint32_t bitdepth, bool no_dither, bool is_float)
-    : FilterBase(source)
+                     uint32_t bitdepth, bool no_dither, bool is_float,
+                     bool noise_shaping)
+    : FilterBase(source),
+      m_noise{NoiseStream(0), NoiseStream(4)}
 {
     const AudioStreamBasicDescription &asbd = source->getSampleFormat();
     m_asbd = cautil::buildASBDForPCM2(asbd.mSampleRate,
@@ -47,27 +80,31 @@ Quantizer::Quantizer(const std::shared_ptr<ISource> &source,
                                       is_float ? kAudioFormatFlagIsFloat
                                         : kAudioFormatFlagIsSignedInteger);
 
-    bool dither = !no_dither && m_asbd.mBitsPerChannel <= 18;
+    m_dither = !no_dither && m_asbd.mBitsPerChannel <= 18;
+    m_shaping = false;
 
     if (m_asbd.mFormatFlags & kAudioFormatFlagIsFloat)
         m_convert = &Quantizer::convertSamples_a2f;
-    else if (asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger) {
-        if (m_asbd.mBitsPerChannel >= asbd.mBitsPerChannel)
-            m_convert = &Quantizer::convertSamples_i2i_0;
-        else if (dither)
-            m_convert = &Quantizer::convertSamples_i2i_2;
-        else
-            m_convert = &Quantizer::convertSamples_i2i_1;
+    else if ((asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger) &&
+             m_asbd.mBitsPerChannel >= asbd.mBitsPerChannel)
+        m_convert = &Quantizer::convertSamples_i2i_0;
+    else if (noise_shaping) {
+        m_shaping = true;
+        m_error.assign(asbd.mChannelsPerFrame * NS_TAPS, 0.0);
+        m_convert = &Quantizer::convertSamples_ns;
     }
+    else if (asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger)
+        m_convert = m_dither ? &Quantizer::convertSamples_i2i_2
+                             : &Quantizer::convertSamples_i2i_1;
     else if (asbd.mBitsPerChannel == 16)
-        m_convert = dither ? &Quantizer::convertSamples_h2i_2
-                           : &Quantizer::convertSamples_h2i_1;
+        m_convert = m_dither ? &Quantizer::convertSamples_h2i_2
+                             : &Quantizer::convertSamples_h2i_1;
     else if (asbd.mBitsPerChannel <= 32)
-        m_convert = dither ? &Quantizer::convertSamples_f2i_2
-                           : &Quantizer::convertSamples_f2i_1;
+        m_convert = m_dither ? &Quantizer::convertSamples_f2i_2
+                             : &Quantizer::convertSamples_f2i_1;
     else
-        m_convert = dither ? &Quantizer::convertSamples_d2i_2
-                           : &Quantizer::convertSamples_d2i_1;
+        m_convert = m_dither ? &Quantizer::convertSamples_d2i_2
+                             : &Quantizer::convertSamples_d2i_1;
 }
 
 size_t Quantizer::convertSamples_a2f(void *buffer, size_t nsamples)
@@ -163,6 +200,14 @@ size_t Quantizer::convertSamples_d2i_2(void *buffer, size_t nsamples)
     return nsamples;
 }
 
+size_t Quantizer::convertSamples_ns(void *buffer, size_t nsamples)
+{
+    nsamples = readSamplesAsFloat(source(), &m_pivot, &m_dbuffer, nsamples);
+    shapeNoise(m_dbuffer.data(), static_cast<int32_t *>(buffer), nsamples,
+               m_asbd.mBitsPerChannel);
+    return nsamples;
+}
+
 /*
  *  MSB <-------------------------> LSB
  *  <----------- original ------------>
@@ -178,7 +223,13 @@ void Quantizer::ditherInt1(int32_t *dst, size_t count, unsigned bits)
     const int half = one / 2;
     const unsigned mask = ~(one - 1);
 
-    for (size_t i = 0; i < count; ++i) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        v4si value = ((load<v4si>(dst + i) >> 1) + half) & mask;
+        value = value > (INT_MAX>>1) ? splat<v4si>(INT_MAX>>1) : value;
+        store(dst + i, value << 1);
+    }
+    for (; i < count; ++i) {
         int value = ((dst[i] >> 1) + half) & mask;
         if (value > INT_MAX>>1) value = INT_MAX>>1;
         dst[i] = value << 1;
@@ -190,10 +241,22 @@ void Quantizer::ditherInt2(int32_t *dst, size_t count, unsigned bits)
     const int one = 1 << (31 - bits);
     const int half = one / 2;
     const unsigned mask = ~(one - 1);
+    const int log2 = 31 - bits;
+    const v4si lo = splat<v4si>(INT_MIN>>1), hi = splat<v4si>(INT_MAX>>1);
 
-    RandomIntSpanShift<RandomEngine> noise(m_engine, 31 - bits);
-    for (size_t i = 0; i < count; ++i) {
-        int value = (dst[i] >> 1) + half + noise() + noise();
+    const uint32_t *noise = m_noise[0].draw(count);
+    const uint32_t *noise2 = m_noise[1].draw(count);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        v4si value = (load<v4si>(dst + i) >> 1) + half
+            + noise_int(load<v4su>(noise + i), log2)
+            + noise_int(load<v4su>(noise2 + i), log2);
+        value &= mask;
+        store(dst + i, vclip(value, lo, hi) << 1);
+    }
+    for (; i < count; ++i) {
+        int value = (dst[i] >> 1) + half
+            + noise_int(noise[i], log2) + noise_int(noise2[i], log2);
         value &= mask;
         dst[i] = clip(value, INT_MIN>>1, INT_MAX>>1) << 1;
     }
@@ -207,7 +270,13 @@ void Quantizer::ditherFloat1(const T *src, int32_t *dst, size_t count,
     double half = static_cast<double>(1U << (bits - 1));
     double min_value = -half;
     double max_value = half - 1;
-    for (size_t i = 0; i < count; ++i) {
+    const v2df lo = splat<v2df>(min_value), hi = splat<v2df>(max_value);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        v2df value = vclip(load2(src + i) * half, lo, hi);
+        store(dst + i, vrint(value) << shifts);
+    }
+    for (; i < count; ++i) {
         double value = src[i] * half;
         dst[i] = lrint(clip(value, min_value, max_value)) << shifts;
     }
@@ -221,15 +290,75 @@ void Quantizer::ditherFloat2(const T *src, int32_t *dst, size_t count,
     double half = static_cast<double>(1U << (bits - 1));
     double min_value = -half;
     double max_value = half - 1;
-    std::uniform_real_distribution<double> dist(-0.5, 0.5);
-    for (size_t i = 0; i < count; ++i) {
-        double value = src[i] * half;
-        double noise = dist(m_engine) + dist(m_engine);
-        value += noise;
+    const v2df lo = splat<v2df>(min_value), hi = splat<v2df>(max_value);
+
+    const uint32_t *noise = m_noise[0].draw(count);
+    const uint32_t *noise2 = m_noise[1].draw(count);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        v2df value = load2(src + i) * half
+            + (uniform(load<v2su>(noise + i))
+               + uniform(load<v2su>(noise2 + i)));
+        value = vclip(value, lo, hi);
+        store(dst + i, vrint(value) << shifts);
+    }
+    for (; i < count; ++i) {
+        double value = src[i] * half
+            + (uniform(noise[i]) + uniform(noise2[i]));
         dst[i] = lrint(clip(value, min_value, max_value)) << shifts;
     }
 }
 
+/*
+ * Error feedback, one channel after another since each sample depends on
+ * the errors made just before it. The error includes the dither, if any.
+ */
+void Quantizer::shapeNoise(const double *src, int32_t *dst, size_t nsamples,
+                           unsigned bits)
+{
+    unsigned nch = m_asbd.mChannelsPerFrame;
+    int shifts = 32 - bits;
+    double half = static_cast<double>(1U << (bits - 1));
+    double min_value = -half;
+    double max_value = half - 1;
+    size_t count = nsamples * nch;
+    const uint32_t *noise = m_noise[0].draw(m_dither ? count : 0);
+    const uint32_t *noise2 = m_noise[1].draw(m_dither ? count : 0);
+
+    for (unsigned c = 0; c < nch; ++c) {
+        double *e = &m_error[c * NS_TAPS];
+        for (size_t i = c; i < count; i += nch) {
+            double value = src[i] * half;
+            for (unsigned k = 0; k < NS_TAPS; ++k)
+                value -= ns_coefs[k] * e[k];
+            double q = value;
+            if (m_dither)
+                q += uniform(noise[i]) + uniform(noise2[i]);
+            q = std::rint(clip(q, min_value, max_value));
+            std::memmove(e + 1, e, (NS_TAPS - 1) * sizeof(double));
+            e[0] = clip(q - value, -NS_MAX_ERROR, NS_MAX_ERROR);
+            dst[i] = static_cast<int32_t>(q) << shifts;
+        }
+    }
+}
+
+const uint32_t *Quantizer::NoiseStream::draw(size_t count)
+{
+    if (m_buffer.size() < count + 4)
+        m_buffer.resize(count + 4);
+    uint32_t *np = m_buffer.data();
+    size_t i = 0;
+    for (; i < count && m_nspare; ++i, --m_nspare)
+        np[i] = m_spare[4 - m_nspare];
+    for (; i < count; i += 4)
+        store(np + i, m_engine());
+    if (i > count) {
+        m_spare = load<v4su>(np + i - 4);
+        m_nspare = i - count;
+    }
+    return np;
+}
+
 void Quantizer::growPivot(size_t nsamples)
 {
     size_t nbytes = nsamples * source()->getSampleFormat().mBytesPerFrame;
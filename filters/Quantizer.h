@@ -2,20 +2,46 @@
 #define INTEGER_SOURCE_H
 
 #include <assert.h>
-#include <random>
 #include "FilterBase.h"
 #include "cautil.h"
 #include "rng.h"
 
+/*
+ * Converts to float32 or to integers of bitdepth bits.
+ *
+ * Dither is TPDF, the sum of two uniform noises, each drawn from four
+ * xorshift generators in parallel. The generators are seeded with
+ * constants, and consumed in sample order whatever the block sizes are,
+ * so that output is reproducible.
+ * With noise_shaping, the quantization error is fed back through a
+ * fixed 5 tap filter per channel, which moves the noise to where the
+ * ear is less sensitive (designed for 44.1kHz and 48kHz).
+ */
 class Quantizer: public FilterBase {
-    typedef rng::LCG RandomEngine;
+    /* uint32 noise, handed out in the order it was generated */
+    class NoiseStream {
+        rng::Xor128x4 m_engine;
+        rng::Xor128x4::result_type m_spare; /* drawn but not used yet */
+        unsigned m_nspare;
+        std::vector<uint32_t> m_buffer;
+    public:
+        explicit NoiseStream(uint32_t seed): m_spare(), m_nspare(0)
+        {
+            m_engine.seed(seed);
+        }
+        const uint32_t *draw(size_t count);
+    };
     AudioStreamBasicDescription m_asbd;
-    RandomEngine m_engine;
+    NoiseStream m_noise[2]; /* one for each half of TPDF */
+    bool m_dither;
+    bool m_shaping;
+    std::vector<double> m_error; /* per channel, latest first */
     std::vector<uint8_t> m_pivot;
+    std::vector<double> m_dbuffer;
     size_t (Quantizer::*m_convert)(void *buffer, size_t nsamples);
 public:
     Quantizer(const std::shared_ptr<ISource> &source, uint32_t bitdepth,
-              bool no_dither, bool is_float=false);
+              bool no_dither, bool is_float=false, bool noise_shaping=false);
     const AudioStreamBasicDescription &getSampleFormat() const
     {
         return m_asbd;
@@ -24,6 +50,12 @@ public:
     {
         return (this->*m_convert)(buffer, nsamples);
     }
+    /* whether noise is added before rounding to integers */
+    bool isDithering() const
+    {
+        return (m_dither || m_shaping)
+            && !(m_asbd.mFormatFlags & kAudioFormatFlagIsFloat);
+    }
 private:
     size_t convertSamples_a2f(void *buffer, size_t nsamples);
     size_t convertSamples_i2i_0(void *buffer, size_t nsamples);
@@ -35,6 +67,7 @@ private:
     size_t convertSamples_f2i_2(void *buffer, size_t nsamples);
     size_t convertSamples_d2i_1(void *buffer, size_t nsamples);
     size_t convertSamples_d2i_2(void *buffer, size_t nsamples);
+    size_t convertSamples_ns(void *buffer, size_t nsamples);
 
     void ditherInt1(int32_t *dst, size_t count, unsigned bits);
     void ditherInt2(int32_t *dst, size_t count, unsigned bits);
@@ -42,6 +75,8 @@ private:
     void ditherFloat1(const T *src, int *dst, size_t count, unsigned bits);
     template <typename T>
     void ditherFloat2(const T *src, int *dst, size_t count, unsigned bits);
+    void shapeNoise(const double *src, int *dst, size_t nsamples,
+                    unsigned bits);
 
     void growPivot(size_t nsamples);
 };
@@ -27,6 +27,7 @@ public:
     {
         return m_asbd;
     }
+    double scale() const { return m_scale; }
     template <typename T>
     size_t readSamplesT(T *buffer, size_t nsamples)
     {
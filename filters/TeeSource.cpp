@@ -0,0 +1,116 @@
+#include <cstring>
+#include "TeeSource.h"
+
+namespace {
+    const size_t NSAMPLES = 0x1000;
+}
+
+TeeSource::TeeSource(const std::shared_ptr<ISource> &src, size_t nbranches,
+                     size_t depth)
+    : m_src(src), m_depth(depth), m_eof(false), m_quit(false)
+{
+    Queue q = { std::deque<block_t>(), 0, false };
+    m_queues.assign(nbranches, q);
+    m_thread = std::thread(&TeeSource::inputThreadProc, this);
+}
+
+TeeSource::~TeeSource()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+std::shared_ptr<ISource> TeeSource::branch(size_t n)
+{
+    return std::make_shared<TeeBranch>(shared_from_this(), n);
+}
+
+size_t TeeSource::read(size_t n, void *buffer, size_t nsamples)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Queue &q = m_queues[n];
+    m_cond.wait(lock, [&] {
+        return q.blocks.size() || m_eof || m_error;
+    });
+    if (q.blocks.empty()) {
+        if (m_error)
+            std::rethrow_exception(m_error);
+        return 0;
+    }
+    const Block &b = *q.blocks.front();
+    uint32_t bpf = m_src->getSampleFormat().mBytesPerFrame;
+    nsamples = std::min(nsamples, b.nsamples - q.offset);
+    std::memcpy(buffer, &b.data[q.offset * bpf], nsamples * bpf);
+    q.offset += nsamples;
+    if (q.offset == b.nsamples) {
+        q.blocks.pop_front();
+        q.offset = 0;
+        lock.unlock();
+        m_cond.notify_all();
+    }
+    return nsamples;
+}
+
+void TeeSource::close(size_t n)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queues[n].closed = true;
+        m_queues[n].blocks.clear();
+    }
+    m_cond.notify_all();
+}
+
+void TeeSource::inputThreadProc()
+{
+    uint32_t bpf = m_src->getSampleFormat().mBytesPerFrame;
+    auto writable = [&] {
+        bool open = false;
+        for (size_t i = 0; i < m_queues.size(); ++i) {
+            if (m_queues[i].closed)
+                continue;
+            if (m_queues[i].blocks.size() >= m_depth)
+                return false;
+            open = true;
+        }
+        return open;
+    };
+    auto alive = [&] {
+        for (size_t i = 0; i < m_queues.size(); ++i)
+            if (!m_queues[i].closed)
+                return true;
+        return false;
+    };
+    try {
+        for (;;) {
+            auto block = std::make_shared<Block>();
+            block->data.resize(NSAMPLES * bpf);
+            block->nsamples = m_src->readSamples(block->data.data(),
+                                                 NSAMPLES);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&] {
+                return m_quit || !alive() || writable();
+            });
+            if (m_quit || !alive())
+                break;
+            if (!block->nsamples) {
+                m_eof = true;
+                break;
+            }
+            for (size_t i = 0; i < m_queues.size(); ++i)
+                if (!m_queues[i].closed)
+                    m_queues[i].blocks.push_back(block);
+            lock.unlock();
+            m_cond.notify_all();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = std::current_exception();
+    }
+    m_cond.notify_all();
+}
@@ -0,0 +1,75 @@
+#ifndef TEE_SOURCE_H
+#define TEE_SOURCE_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <condition_variable>
+#include "ISource.h"
+
+/*
+ * Reads the upstream source once on its own thread and hands the same
+ * blocks to every branch. Each branch has a bounded queue, so decoding
+ * never runs ahead of the slowest consumer by more than the queue depth.
+ * A branch which is destroyed early is simply dropped from the fan-out.
+ */
+class TeeSource: public std::enable_shared_from_this<TeeSource> {
+    struct Block {
+        std::vector<uint8_t> data;
+        size_t nsamples;
+    };
+    typedef std::shared_ptr<const Block> block_t;
+    struct Queue {
+        std::deque<block_t> blocks;
+        size_t offset;
+        bool closed;
+    };
+    std::shared_ptr<ISource> m_src;
+    std::vector<Queue> m_queues;
+    size_t m_depth;
+    bool m_eof, m_quit;
+    std::exception_ptr m_error;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+public:
+    TeeSource(const std::shared_ptr<ISource> &src, size_t nbranches,
+              size_t depth=16);
+    ~TeeSource();
+    std::shared_ptr<ISource> branch(size_t n);
+    size_t read(size_t n, void *buffer, size_t nsamples);
+    void close(size_t n);
+    const std::shared_ptr<ISource> &sourcePtr() const { return m_src; }
+private:
+    void inputThreadProc();
+};
+
+class TeeBranch: public ISource {
+    std::shared_ptr<TeeSource> m_tee;
+    size_t m_index;
+    int64_t m_position;
+public:
+    TeeBranch(const std::shared_ptr<TeeSource> &tee, size_t index)
+        : m_tee(tee), m_index(index), m_position(0)
+    {}
+    ~TeeBranch() { m_tee->close(m_index); }
+    uint64_t length() const { return m_tee->sourcePtr()->length(); }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_tee->sourcePtr()->getSampleFormat();
+    }
+    const std::vector<uint32_t> *getChannels() const
+    {
+        return m_tee->sourcePtr()->getChannels();
+    }
+    int64_t getPosition() { return m_position; }
+    size_t readSamples(void *buffer, size_t nsamples)
+    {
+        size_t n = m_tee->read(m_index, buffer, nsamples);
+        m_position += n;
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned nthreads, const job_t &job)
+    : m_job(job), m_generation(0), m_pending(0), m_quit(false)
+{
+    for (unsigned i = 1; i < nthreads; ++i)
+        m_workers.push_back(std::thread(&WorkerPool::workerThreadProc,
+                                        this, i));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+}
+
+void WorkerPool::run()
+{
+    if (m_workers.empty())
+        return m_job(0, 1);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_generation;
+        m_pending = m_workers.size();
+    }
+    m_cond.notify_all();
+    m_job(0, size());
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [&] { return !m_pending; });
+}
+
+void WorkerPool::workerThreadProc(unsigned n)
+{
+    uint64_t generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&] {
+                return m_quit || m_generation != generation;
+            });
+            if (m_quit)
+                return;
+            generation = m_generation;
+        }
+        m_job(n, size());
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_pending;
+        }
+        m_cond.notify_all();
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+/*
+ * A fixed set of threads which all run the same job, once per call to
+ * run(). The calling thread takes part as worker 0, and run() returns
+ * when every worker is done; the job is called as job(n, nthreads), so
+ * it can split the work by n.
+ */
+class WorkerPool {
+public:
+    typedef std::function<void(unsigned n, unsigned nthreads)> job_t;
+private:
+    job_t m_job;
+    uint64_t m_generation;
+    unsigned m_pending;
+    bool m_quit;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<std::thread> m_workers;
+public:
+    WorkerPool(unsigned nthreads, const job_t &job);
+    ~WorkerPool();
+    unsigned size() const { return m_workers.size() + 1; }
+    void run();
+private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+    void workerThreadProc(unsigned n);
+};
+
+#endif
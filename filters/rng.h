@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <limits>
+#include "simd.h"
 
 namespace rng {
     class LCG
@@ -58,5 +59,36 @@ namespace rng {
             return x_[3] ^=  x_[3] >> c ^ t ^ t >> b;
         }
     };
+
+    /*
+     * Four Xor128 side by side, each lane seeded with its own number.
+     * Every call advances all of them and returns one output of each.
+     */
+    class Xor128x4
+    {
+        typedef simd::v4su v4su;
+        v4su x_[4];
+        static const int a = 11, b = 8, c = 19;
+    public:
+        typedef v4su result_type;
+
+        Xor128x4() { seed(0); }
+        void seed(uint32_t n)
+        {
+            for (int lane = 0; lane < 4; ++lane) {
+                uint32_t x = n + lane;
+                for (int i = 0; i < 4; ++i)
+                    x_[i][lane] = x = 1812433253 * (x ^ (x >> 30)) + i;
+            }
+        }
+        result_type operator()()
+        {
+            v4su t = x_[0] ^ x_[0] << a;
+            x_[0] = x_[1];
+            x_[1] = x_[2];
+            x_[2] = x_[3];
+            return x_[3] ^= x_[3] >> c ^ t ^ t >> b;
+        }
+    };
 }
 #endif
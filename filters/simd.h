@@ -0,0 +1,36 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstdint>
+#include <cstring>
+
+/*
+ * GCC vector extension types, and loads and stores for them which don't
+ * need aligned pointers. Nothing wider than 16 bytes: without -mavx, that
+ * would change the ABI of functions taking or returning them.
+ */
+namespace simd {
+    typedef float v4sf __attribute__((vector_size(16)));
+    typedef int32_t v4si __attribute__((vector_size(16)));
+    typedef uint32_t v4su __attribute__((vector_size(16)));
+    typedef double v2df __attribute__((vector_size(16)));
+    typedef float v2sf __attribute__((vector_size(8)));
+    typedef int32_t v2si __attribute__((vector_size(8)));
+    typedef uint32_t v2su __attribute__((vector_size(8)));
+
+    template <typename V, typename T> inline V load(const T *p)
+    {
+        V v;
+        std::memcpy(&v, p, sizeof v);
+        return v;
+    }
+
+    inline v4sf load(const float *p) { return load<v4sf>(p); }
+
+    template <typename V, typename T> inline void store(T *p, V v)
+    {
+        std::memcpy(p, &v, sizeof v);
+    }
+}
+
+#endif
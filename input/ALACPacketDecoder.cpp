@@ -40,6 +40,11 @@ size_t ALACPacketDecoder::decode(void *data, size_t nsamples)
         uint32_t bpf =
             (m_oasbd.mBitsPerChannel + 7) / 8 * m_oasbd.mChannelsPerFrame;
         size_t nbytes = ncount * bpf;
+        if (!m_decode_buffer.count() && ncount <= nsamples) {
+            util::unpack(m_raw_decode_buffer.data(), data, &nbytes,
+                         bpf / m_oasbd.mChannelsPerFrame, 4);
+            return ncount;
+        }
         m_decode_buffer.reserve(ncount);
         util::unpack(m_raw_decode_buffer.data(), m_decode_buffer.write_ptr(),
                      &nbytes, bpf / m_oasbd.mChannelsPerFrame, 4);
@@ -0,0 +1,203 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "AsyncReader.h"
+#include "util.h"
+
+AsyncReader::AsyncReader(int fd, int64_t offset, bool seekable,
+                         size_t blocksize, size_t depth)
+    : m_fd(fd), m_seekable(seekable), m_blocksize(blocksize),
+      m_nthreads(seekable ? 2 : 1), m_issued(0), m_consumed(0),
+      m_eof_seq(~0ULL), m_block_pos(0), m_offset(offset),
+      m_position(offset), m_generation(0), m_quit(false)
+{
+    m_wakeup[0] = m_wakeup[1] = -1;
+    Block b = { std::vector<uint8_t>(), 0, false };
+    m_blocks.assign(depth, b);
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (m_seekable)
+        posix_fadvise(m_fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+AsyncReader::~AsyncReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    if (m_wakeup[1] >= 0) {
+        char c = 0;
+        while (write(m_wakeup[1], &c, 1) < 0 && errno == EINTR)
+            ;
+    }
+    for (size_t i = 0; i < m_threads.size(); ++i)
+        m_threads[i].join();
+    for (int i = 0; i < 2; ++i)
+        if (m_wakeup[i] >= 0)
+            close(m_wakeup[i]);
+}
+
+void AsyncReader::start()
+{
+    if (!m_seekable && pipe(m_wakeup) < 0)
+        util::throw_crt_error("pipe()");
+    for (unsigned i = 0; i < m_nthreads; ++i)
+        m_threads.push_back(std::thread(&AsyncReader::readThreadProc, this));
+}
+
+ssize_t AsyncReader::read(void *buffer, size_t size)
+{
+    if (m_threads.empty())
+        start();
+    uint8_t *bp = static_cast<uint8_t*>(buffer);
+    size_t total = 0;
+    while (total < size) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Block &b = m_blocks[m_consumed % m_blocks.size()];
+        m_cond.wait(lock, [&] {
+            return b.ready || m_consumed >= m_eof_seq;
+        });
+        if (!b.ready) {
+            if (m_error && !total)
+                std::rethrow_exception(m_error);
+            break;
+        }
+        lock.unlock();
+
+        /* the block is ours until it is marked free again */
+        size_t n = std::min(size - total, b.size - m_block_pos);
+        std::memcpy(bp + total, &b.data[m_block_pos], n);
+        total += n;
+        m_block_pos += n;
+        m_position += n;
+        if (m_block_pos == b.size) {
+            lock.lock();
+            b.ready = false;
+            ++m_consumed;
+            m_block_pos = 0;
+            lock.unlock();
+            m_cond.notify_all();
+        }
+    }
+    return total;
+}
+
+void AsyncReader::seek(int64_t offset)
+{
+    if (!m_seekable)
+        throw std::runtime_error("AsyncReader: input is not seekable");
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_generation;
+        for (size_t i = 0; i < m_blocks.size(); ++i)
+            m_blocks[i].ready = false;
+        m_issued = m_consumed = 0;
+        m_eof_seq = ~0ULL;
+        m_block_pos = 0;
+        m_offset = m_position = offset;
+        m_error = nullptr;
+    }
+    m_cond.notify_all();
+}
+
+/*
+ * Like util::nread(), but gives up and returns -1 once the destructor
+ * writes to the self-pipe.
+ */
+ssize_t AsyncReader::readPipe(uint8_t *buffer, size_t size)
+{
+    size_t total = 0;
+    while (total < size) {
+        struct pollfd fds[2] = {
+            { m_fd, POLLIN, 0 }, { m_wakeup[0], POLLIN, 0 }
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            util::throw_crt_error("poll()");
+        }
+        if (fds[1].revents)
+            return -1;
+        ssize_t n = ::read(m_fd, buffer + total, size - total);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            util::throw_crt_error("read()");
+        if (n == 0)
+            break;
+        total += n;
+    }
+    return total;
+}
+
+void AsyncReader::readThreadProc()
+{
+    std::vector<uint8_t> buffer;
+    for (;;) {
+        uint64_t seq;
+        int64_t offset;
+        unsigned generation;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&] {
+                return m_quit || (m_issued < m_eof_seq && !m_error &&
+                                  m_issued - m_consumed < m_blocks.size());
+            });
+            if (m_quit)
+                break;
+            seq = m_issued++;
+            offset = m_offset;
+            m_offset += m_blocksize;
+            generation = m_generation;
+        }
+        buffer.resize(m_blocksize);
+        ssize_t n;
+        try {
+            if (m_seekable) {
+                size_t done = 0;
+                while (done < m_blocksize) {
+                    n = pread(m_fd, &buffer[done], m_blocksize - done,
+                              offset + done);
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n < 0)
+                        util::throw_crt_error("pread()");
+                    if (n == 0)
+                        break;
+                    done += n;
+                }
+                n = done;
+            } else if ((n = readPipe(&buffer[0], m_blocksize)) < 0)
+                break; /* woken up by the destructor */
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (generation == m_generation) {
+                m_error = std::current_exception();
+                m_eof_seq = std::min(m_eof_seq, seq);
+            }
+            m_cond.notify_all();
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (generation != m_generation)
+                continue;
+            if (static_cast<size_t>(n) < m_blocksize)
+                m_eof_seq = std::min(m_eof_seq, seq + 1);
+            if (n == 0)
+                m_eof_seq = std::min(m_eof_seq, seq);
+            else {
+                Block &b = m_blocks[seq % m_blocks.size()];
+                b.data.swap(buffer);
+                b.size = n;
+                b.ready = true;
+            }
+        }
+        m_cond.notify_all();
+    }
+}
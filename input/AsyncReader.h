@@ -0,0 +1,57 @@
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <condition_variable>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Read-ahead over a file descriptor. Helper threads keep a fixed number of
+ * large blocks in flight ahead of the consumer, so that read() mostly
+ * copies from memory instead of waiting on the storage.
+ * Seekable files are read with pread() from several threads at once;
+ * anything else is read sequentially by a single thread, which polls the
+ * input together with a self-pipe, so that the destructor can wake it up
+ * while a pipe is idle. Threads are not started until the first read().
+ */
+class AsyncReader {
+    struct Block {
+        std::vector<uint8_t> data;
+        size_t size;
+        bool ready;
+    };
+    int m_fd;
+    bool m_seekable;
+    size_t m_blocksize;
+    unsigned m_nthreads;
+    std::vector<Block> m_blocks;
+    uint64_t m_issued, m_consumed; /* block sequence numbers */
+    uint64_t m_eof_seq; /* first block past the end, or ~0 */
+    size_t m_block_pos; /* read position within the current block */
+    int64_t m_offset; /* file offset of block m_issued */
+    int64_t m_position; /* file offset of the next byte read() returns */
+    unsigned m_generation; /* bumped on seek to drop stale reads */
+    bool m_quit;
+    int m_wakeup[2]; /* self-pipe; written to on destruction */
+    std::exception_ptr m_error;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<std::thread> m_threads;
+public:
+    AsyncReader(int fd, int64_t offset, bool seekable,
+                size_t blocksize=0x80000, size_t depth=4);
+    ~AsyncReader();
+    ssize_t read(void *buffer, size_t size);
+    void seek(int64_t offset);
+    int64_t tell() const { return m_position; }
+private:
+    void start();
+    ssize_t readPipe(uint8_t *buffer, size_t size);
+    void readThreadProc();
+};
+
+#endif
@@ -153,6 +153,7 @@ ExtAFSource::ExtAFSource(const std::shared_ptr<FILE> &fp)
             m_tags = audiofile::fetchTags(m_af, m_fp.get());
         } catch (...) {}
     }
+    misc::moveArtwork(&m_tags, &m_artworks);
     try {
         auto ptinfo = m_af.getPacketTableInfo();
         if (ptinfo.mPrimingFrames && !ptinfo.mNumberValidFrames) {
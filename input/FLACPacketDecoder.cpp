@@ -11,7 +11,8 @@ namespace {
 #define TRYFL(expr) (void)(try__((expr), #expr))
 
 FLACPacketDecoder::FLACPacketDecoder(IPacketFeeder *feeder)
-    : m_feeder(feeder), m_module(FLACModule::instance())
+    : m_feeder(feeder), m_direct(0), m_direct_size(0), m_direct_count(0),
+      m_module(FLACModule::instance())
 {
     if (!m_module.loaded()) throw std::runtime_error("libFLAC not loaded");
     memset(&m_iasbd, 0, sizeof(m_iasbd));
@@ -68,7 +69,15 @@ size_t FLACPacketDecoder::decode(void *data, size_t nsamples)
         auto p = m_packet_buffer.write_ptr();
         std::memcpy(p, m_feed_buffer.data(), m_feed_buffer.size());
         m_packet_buffer.commit(m_feed_buffer.size());
-        TRYFL(m_module.stream_decoder_process_single(m_decoder.get()));
+        m_direct = m_decode_buffer.count() ? 0 : static_cast<int32_t*>(data);
+        m_direct_size = nsamples;
+        m_direct_count = 0;
+        FLAC__bool ok =
+            m_module.stream_decoder_process_single(m_decoder.get());
+        m_direct = 0;
+        TRYFL(ok);
+        if (m_direct_count)
+            return m_direct_count;
     }
     nsamples = std::min(nsamples, m_decode_buffer.count());
     if (nsamples)
@@ -105,12 +114,19 @@ FLACPacketDecoder::writeCallback(const FLAC__Frame *frame,
      * shifting to MSB side.
      */
     uint32_t shifts = 32 - h.bits_per_sample;
-    m_decode_buffer.reserve(h.blocksize);
-    int32_t *bp = m_decode_buffer.write_ptr();
+    int32_t *bp;
+    if (m_direct && h.blocksize <= m_direct_size) {
+        bp = m_direct;
+        m_direct = 0;
+        m_direct_count = h.blocksize;
+    } else {
+        m_decode_buffer.reserve(h.blocksize);
+        bp = m_decode_buffer.write_ptr();
+        m_decode_buffer.commit(h.blocksize);
+    }
     for (size_t i = 0; i < h.blocksize; ++i)
         for (size_t n = 0; n < h.channels; ++n)
             *bp++ = (buffer[n][i] << shifts);
-    m_decode_buffer.commit(h.blocksize);
 
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
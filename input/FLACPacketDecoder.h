@@ -15,6 +15,8 @@ class FLACPacketDecoder: public IPacketDecoder {
     std::vector<uint8_t> m_feed_buffer;
     util::FIFO<uint8_t> m_packet_buffer;
     util::FIFO<int32_t> m_decode_buffer;
+    int32_t *m_direct; /* caller's buffer while decode() is running */
+    size_t m_direct_size, m_direct_count;
     FLACModule &m_module;
 public:
     FLACPacketDecoder(IPacketFeeder *feeder);
@@ -29,14 +29,181 @@ namespace flac {
 }
 #define TRYFL(expr) (void)(flac::try__((expr), #expr))
 
-FLACSource::FLACSource(const std::shared_ptr<FILE> &fp):
+namespace flac {
+    /*
+     * FLAC sample is aligned to low. We make it aligned to high by
+     * shifting to MSB side, interleaving on the way.
+     * Loops are kept simple enough for the compiler to vectorize, though
+     * it only does so from -O2 (-O3 before GCC 12); not at our -O1.
+     */
+    void interleave(const FLAC__int32 * const *src, int32_t *dst,
+                    unsigned nchannels, size_t nframes, unsigned shifts)
+    {
+        if (nchannels == 1) {
+            const FLAC__int32 *s0 = src[0];
+            for (size_t i = 0; i < nframes; ++i)
+                dst[i] = s0[i] << shifts;
+        } else if (nchannels == 2) {
+            const FLAC__int32 *s0 = src[0], *s1 = src[1];
+            for (size_t i = 0; i < nframes; ++i) {
+                dst[2 * i] = s0[i] << shifts;
+                dst[2 * i + 1] = s1[i] << shifts;
+            }
+        } else {
+            for (unsigned n = 0; n < nchannels; ++n) {
+                const FLAC__int32 *sp = src[n];
+                int32_t *dp = dst + n;
+                for (size_t i = 0; i < nframes; ++i)
+                    dp[i * nchannels] = sp[i] << shifts;
+            }
+        }
+    }
+
+    /*
+     * Decoder for a worker thread of the parallel mode. Shares the file
+     * descriptor with the main decoder, but keeps an offset of its own
+     * and reads with pread().
+     */
+    class RangeDecoder {
+        FLACModule &m_module;
+        int m_fd;
+        uint64_t m_offset;
+        uint64_t m_filesize;
+        unsigned m_nchannels;
+        unsigned m_shifts;
+        uint64_t m_want;
+        std::vector<int32_t> *m_out;
+        std::shared_ptr<FLAC__StreamDecoder> m_decoder;
+    public:
+        RangeDecoder(int fd, const AudioStreamBasicDescription &asbd)
+            : m_module(FLACModule::instance()), m_fd(fd), m_offset(0),
+              m_nchannels(asbd.mChannelsPerFrame),
+              m_shifts(32 - asbd.mBitsPerChannel), m_want(0), m_out(0)
+        {
+            m_filesize = win32::filelengthi64(fd);
+            FLACModule &module = m_module;
+            m_decoder.reset(m_module.stream_decoder_new(),
+                            [&module](FLAC__StreamDecoder *decoder) {
+                                module.stream_decoder_finish(decoder);
+                                module.stream_decoder_delete(decoder);
+                            });
+            TRYFL(m_module.stream_decoder_init_stream(m_decoder.get(),
+                                                      staticReadCallback,
+                                                      staticSeekCallback,
+                                                      staticTellCallback,
+                                                      staticLengthCallback,
+                                                      staticEofCallback,
+                                                      staticWriteCallback,
+                                                      0,
+                                                      staticErrorCallback,
+                                                      this)
+                  == FLAC__STREAM_DECODER_INIT_STATUS_OK);
+        }
+        void decode(uint64_t start, uint64_t count, std::vector<int32_t> *out)
+        {
+            out->clear();
+            out->reserve(count * m_nchannels);
+            m_out = out;
+            m_want = count;
+            TRYFL(m_module.stream_decoder_seek_absolute(m_decoder.get(),
+                                                        start));
+            while (out->size() < count * m_nchannels) {
+                if (m_module.stream_decoder_get_state(m_decoder.get()) ==
+                        FLAC__STREAM_DECODER_END_OF_STREAM)
+                    break;
+                TRYFL(m_module.stream_decoder_process_single(m_decoder.get()));
+            }
+            m_out = 0;
+        }
+    private:
+        static FLAC__StreamDecoderReadStatus staticReadCallback(
+                const FLAC__StreamDecoder *, FLAC__byte *buffer,
+                size_t *bytes, void *client_data)
+        {
+            RangeDecoder *self = static_cast<RangeDecoder*>(client_data);
+            ssize_t n;
+            do
+                n = pread(self->m_fd, buffer, *bytes, self->m_offset);
+            while (n < 0 && errno == EINTR);
+            if (n < 0)
+                return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+            if (n == 0)
+                return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+            self->m_offset += n;
+            *bytes = n;
+            return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+        }
+        static FLAC__StreamDecoderSeekStatus staticSeekCallback(
+                const FLAC__StreamDecoder *, FLAC__uint64 offset,
+                void *client_data)
+        {
+            static_cast<RangeDecoder*>(client_data)->m_offset = offset;
+            return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+        }
+        static FLAC__StreamDecoderTellStatus staticTellCallback(
+                const FLAC__StreamDecoder *, FLAC__uint64 *offset,
+                void *client_data)
+        {
+            *offset = static_cast<RangeDecoder*>(client_data)->m_offset;
+            return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+        }
+        static FLAC__StreamDecoderLengthStatus staticLengthCallback(
+                const FLAC__StreamDecoder *, FLAC__uint64 *length,
+                void *client_data)
+        {
+            *length = static_cast<RangeDecoder*>(client_data)->m_filesize;
+            return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+        }
+        static FLAC__bool staticEofCallback(const FLAC__StreamDecoder *,
+                                            void *client_data)
+        {
+            RangeDecoder *self = static_cast<RangeDecoder*>(client_data);
+            return self->m_offset >= self->m_filesize;
+        }
+        static FLAC__StreamDecoderWriteStatus staticWriteCallback(
+                const FLAC__StreamDecoder *, const FLAC__Frame *frame,
+                const FLAC__int32 * const *buffer, void *client_data)
+        {
+            RangeDecoder *self = static_cast<RangeDecoder*>(client_data);
+            const FLAC__FrameHeader &h = frame->header;
+            if (!self->m_out || h.channels != self->m_nchannels
+             || 32 - h.bits_per_sample != self->m_shifts)
+                return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+            std::vector<int32_t> *out = self->m_out;
+            size_t have = out->size() / self->m_nchannels;
+            size_t n = std::min(static_cast<uint64_t>(h.blocksize),
+                                self->m_want - have);
+            out->resize((have + n) * self->m_nchannels);
+            interleave(buffer, out->data() + have * self->m_nchannels,
+                       self->m_nchannels, n, self->m_shifts);
+            return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+        }
+        static void staticErrorCallback(const FLAC__StreamDecoder *,
+                                        FLAC__StreamDecoderErrorStatus,
+                                        void *)
+        {
+        }
+    };
+}
+
+namespace {
+    /* ranges are about this many samples long */
+    const uint64_t RANGE_SIZE = 1 << 18;
+}
+
+FLACSource::FLACSource(const std::shared_ptr<FILE> &fp, unsigned nthreads):
     m_eof(false),
     m_giveup(false),
     m_initialize_done(false),
     m_length(0),
     m_position(0),
+    m_blocksize(0),
+    m_nthreads(nthreads),
     m_fp(fp),
-    m_module(FLACModule::instance())
+    m_module(FLACModule::instance()),
+    m_next_bound(0),
+    m_range_offset(0),
+    m_quit(false)
 {
     if (!m_module.loaded()) throw std::runtime_error("libFLAC not loaded");
     char buffer[33];
@@ -58,11 +225,14 @@ FLACSource::FLACSource(const std::shared_ptr<FILE> &fp):
 
     m_decoder =
         decoder_t(m_module.stream_decoder_new(),
-                  std::bind(std::mem_fn(&FLACSource::close), this));
+                  std::bind(std::mem_fn(&FLACSource::close), this,
+                            std::placeholders::_1));
     TRYFL(m_module.stream_decoder_set_metadata_respond(
                 m_decoder.get(), FLAC__METADATA_TYPE_VORBIS_COMMENT));
     TRYFL(m_module.stream_decoder_set_metadata_respond(
                 m_decoder.get(), FLAC__METADATA_TYPE_PICTURE));
+    TRYFL(m_module.stream_decoder_set_metadata_respond(
+                m_decoder.get(), FLAC__METADATA_TYPE_SEEKTABLE));
 
     TRYFL((fcc == 'OggS' ? m_module.stream_decoder_init_ogg_stream
                          : m_module.stream_decoder_init_stream)
@@ -82,12 +252,28 @@ FLACSource::FLACSource(const std::shared_ptr<FILE> &fp):
         flac::want(false);
     m_buffer.set_unit(m_asbd.mChannelsPerFrame);
     m_initialize_done = true;
+    if (m_nthreads > 1 && fcc == 'fLaC' && m_length > 0 && isSeekable())
+        setupRanges();
+}
+
+FLACSource::~FLACSource()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+    m_decoder.reset();
 }
 
 void FLACSource::seekTo(int64_t count)
 {
     if (count == m_position)
         return;
+    if (isParallel())
+        return seekToParallel(count);
     m_buffer.reset();
     m_giveup = false;
     TRYFL(m_module.stream_decoder_seek_absolute(m_decoder.get(), count));
@@ -96,6 +282,8 @@ void FLACSource::seekTo(int64_t count)
 
 size_t FLACSource::readSamples(void *buffer, size_t nsamples)
 {
+    if (isParallel())
+        return readSamplesParallel(buffer, nsamples);
     if (!m_buffer.count()) {
         if (m_module.stream_decoder_get_state(m_decoder.get()) ==
                 FLAC__STREAM_DECODER_END_OF_STREAM)
@@ -146,7 +334,7 @@ FLACSource::tellCallback(uint64_t *offset)
 FLAC__StreamDecoderLengthStatus
 FLACSource::lengthCallback(uint64_t *length)
 {
-    int64_t len = _filelengthi64(fileno(m_fp.get()));
+    int64_t len = win32::filelengthi64(fileno(m_fp.get()));
     if (len < 0)
         return FLAC__STREAM_DECODER_LENGTH_STATUS_ERROR;
     *length = len;
@@ -168,16 +356,9 @@ FLACSource::writeCallback( const FLAC__Frame *frame,
      || h.bits_per_sample != m_asbd.mBitsPerChannel)
         return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 
-    /*
-     * FLAC sample is aligned to low. We make it aligned to high by
-     * shifting to MSB side.
-     */
-    uint32_t shifts = 32 - h.bits_per_sample;
     m_buffer.reserve(h.blocksize);
-    int32_t *bp = m_buffer.write_ptr();
-    for (size_t i = 0; i < h.blocksize; ++i)
-        for (size_t n = 0; n < h.channels; ++n)
-            *bp++ = (buffer[n][i] << shifts);
+    flac::interleave(buffer, m_buffer.write_ptr(), h.channels, h.blocksize,
+                     32 - h.bits_per_sample);
     m_buffer.commit(h.blocksize);
 
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
@@ -193,6 +374,8 @@ void FLACSource::metadataCallback(const FLAC__StreamMetadata *metadata)
         handleVorbisComment(metadata->data.vorbis_comment);
     else if (metadata->type == FLAC__METADATA_TYPE_PICTURE)
         handlePicture(metadata->data.picture);
+    else if (metadata->type == FLAC__METADATA_TYPE_SEEKTABLE)
+        handleSeekTable(metadata->data.seek_table);
 }
 
 void FLACSource::errorCallback(FLAC__StreamDecoderErrorStatus status)
@@ -204,11 +387,13 @@ void FLACSource::handleStreamInfo(const FLAC__StreamMetadata_StreamInfo &si)
 {
     try {
         flac::validate(si);
-    } catch (const std::runtime_error) {
+    } catch (const std::runtime_error &) {
         m_giveup = true;
         return;
     }
     m_length = si.total_samples;
+    if (si.min_blocksize == si.max_blocksize)
+        m_blocksize = si.max_blocksize;
     m_asbd = cautil::buildASBDForPCM2(si.sample_rate, si.channels,
                                       si.bits_per_sample, 32,
                                       kAudioFormatFlagIsSignedInteger);
@@ -237,5 +422,157 @@ void FLACSource::handleVorbisComment(
 void FLACSource::handlePicture(const FLAC__StreamMetadata_Picture &pic)
 {
     if (pic.type == FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER)
-        m_tags["COVER ART"] = std::string(pic.data, pic.data + pic.data_length);
+        m_artworks.push_back(misc::internBlob(pic.data, pic.data_length));
+}
+
+void FLACSource::handleSeekTable(const FLAC__StreamMetadata_SeekTable &st)
+{
+    for (unsigned i = 0; i < st.num_points; ++i) {
+        uint64_t sample = st.points[i].sample_number;
+        if (sample != FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER)
+            m_seekpoints.push_back(sample);
+    }
+}
+
+void FLACSource::setupRanges()
+{
+    /*
+     * Seek points are frame starts, and so are multiples of the block size
+     * in a fixed block size stream. Without either, libFLAC's seek will
+     * find the frame by sync search, and decoding just starts mid-frame.
+     */
+    uint64_t last = 0;
+    m_bounds.push_back(0);
+    if (m_seekpoints.size()) {
+        std::sort(m_seekpoints.begin(), m_seekpoints.end());
+        for (size_t i = 0; i < m_seekpoints.size(); ++i) {
+            uint64_t pos = m_seekpoints[i];
+            if (pos >= m_length)
+                break;
+            if (pos - last >= RANGE_SIZE)
+                m_bounds.push_back(last = pos);
+        }
+    } else {
+        uint64_t step = RANGE_SIZE;
+        if (m_blocksize)
+            step = std::max(RANGE_SIZE / m_blocksize, uint64_t(1)) * m_blocksize;
+        for (uint64_t pos = step; pos < m_length; pos += step)
+            m_bounds.push_back(pos);
+    }
+    m_bounds.push_back(m_length);
+    m_seekpoints.clear();
+    m_next_bound = 0;
+    m_range_offset = 0;
+}
+
+void FLACSource::queueRanges()
+{
+    if (m_workers.empty()) {
+        for (unsigned i = 0; i < m_nthreads; ++i)
+            m_workers.emplace_back(&FLACSource::workerThreadProc, this);
+    }
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (m_ranges.size() < 2 * m_nthreads &&
+               m_next_bound + 1 < m_bounds.size()) {
+            uint64_t start = m_bounds[m_next_bound];
+            if (m_ranges.empty())
+                start = std::max(start, static_cast<uint64_t>(m_position));
+            auto range = std::make_shared<Range>();
+            range->start = start;
+            range->count = m_bounds[++m_next_bound] - start;
+            range->ready = false;
+            m_ranges.push_back(range);
+            m_jobs.push_back(range);
+            queued = true;
+        }
+    }
+    if (queued)
+        m_cond.notify_all();
+}
+
+size_t FLACSource::readSamplesParallel(void *buffer, size_t nsamples)
+{
+    queueRanges();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_ranges.empty())
+        return 0;
+    std::shared_ptr<Range> range = m_ranges.front();
+    m_cond.wait(lock, [&] { return range->ready; });
+    if (range->error)
+        std::rethrow_exception(range->error);
+    lock.unlock();
+
+    unsigned nc = m_asbd.mChannelsPerFrame;
+    size_t have = range->data.size() / nc;
+    size_t count = std::min(have - m_range_offset, nsamples);
+    std::memcpy(buffer, &range->data[m_range_offset * nc],
+                count * nc * sizeof(int32_t));
+    m_range_offset += count;
+    m_position += count;
+    if (m_range_offset == have) {
+        lock.lock();
+        m_ranges.pop_front();
+        /* a short range means the stream ended early */
+        if (have < range->count) {
+            m_ranges.clear();
+            m_jobs.clear();
+            m_next_bound = m_bounds.size() - 1;
+        }
+        lock.unlock();
+        m_range_offset = 0;
+        if (!count)
+            return readSamplesParallel(buffer, nsamples);
+    }
+    return count;
+}
+
+void FLACSource::seekToParallel(int64_t count)
+{
+    if (count < 0 || static_cast<uint64_t>(count) > m_length)
+        throw std::runtime_error("FLACSource: invalid seek offset");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    /* ranges still being decoded are simply thrown away when done */
+    m_ranges.clear();
+    m_jobs.clear();
+    /* at the end, queue nothing rather than an empty range */
+    if (static_cast<uint64_t>(count) >= m_length)
+        m_next_bound = m_bounds.size() - 1;
+    else
+        m_next_bound = std::upper_bound(m_bounds.begin(), m_bounds.end() - 1,
+                                        static_cast<uint64_t>(count))
+                     - m_bounds.begin() - 1;
+    m_range_offset = 0;
+    m_position = count;
+}
+
+void FLACSource::workerThreadProc()
+{
+    std::shared_ptr<flac::RangeDecoder> decoder;
+    for (;;) {
+        std::shared_ptr<Range> range;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&] { return m_quit || m_jobs.size(); });
+            if (m_quit)
+                break;
+            range = m_jobs.front();
+            m_jobs.pop_front();
+        }
+        try {
+            if (!decoder)
+                decoder = std::make_shared<flac::RangeDecoder>(
+                                fileno(m_fp.get()), m_asbd);
+            decoder->decode(range->start, range->count, &range->data);
+        } catch (...) {
+            range->error = std::current_exception();
+            decoder.reset();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            range->ready = true;
+        }
+        m_cond.notify_all();
+    }
 }
@@ -2,28 +2,59 @@
 #define _FLACSRC_H
 
 #include <deque>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <condition_variable>
 #include <FLAC/all.h>
 #include "ISource.h"
 #include "FLACModule.h"
+#include "util.h"
+#include "win32util.h"
 
 class FLACSource: public ISeekableSource, public ITagParser
 {
     typedef std::shared_ptr<FLAC__StreamDecoder> decoder_t;
+    /*
+     * Parallel mode: the stream is cut into frame aligned sample ranges,
+     * which are decoded on worker threads by decoders of their own and
+     * handed out in order.
+     */
+    struct Range {
+        uint64_t start, count;
+        std::vector<int32_t> data;
+        bool ready;
+        std::exception_ptr error;
+    };
     bool m_eof;
     bool m_giveup;
     bool m_initialize_done;
     decoder_t m_decoder;
     uint64_t m_length;
     int64_t m_position;
+    uint32_t m_blocksize;
+    unsigned m_nthreads;
     std::shared_ptr<FILE> m_fp;
     std::vector<uint32_t> m_chanmap;
     std::map<std::string, std::string> m_tags;
+    std::vector<misc::blob_t> m_artworks;
+    std::vector<uint64_t> m_seekpoints;
     util::FIFO<int32_t> m_buffer;
     AudioStreamBasicDescription m_asbd;
     FLACModule &m_module;
+
+    std::vector<uint64_t> m_bounds;
+    size_t m_next_bound;
+    size_t m_range_offset;
+    std::deque<std::shared_ptr<Range> > m_ranges;
+    std::deque<std::shared_ptr<Range> > m_jobs;
+    bool m_quit;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<std::thread> m_workers;
 public:
-    FLACSource(const std::shared_ptr<FILE> &fp);
-    ~FLACSource() { m_decoder.reset(); }
+    FLACSource(const std::shared_ptr<FILE> &fp, unsigned nthreads=1);
+    ~FLACSource();
     uint64_t length() const { return m_length; }
     const AudioStreamBasicDescription &getSampleFormat() const
     {
@@ -38,6 +69,10 @@ public:
     bool isSeekable() { return win32::is_seekable(fileno(m_fp.get())); }
     void seekTo(int64_t count);
     const std::map<std::string, std::string> &getTags() const { return m_tags; }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        return m_artworks;
+    }
 private:
     void close(FLAC__StreamDecoder *decoder)
     {
@@ -121,6 +156,14 @@ private:
     void handleStreamInfo(const FLAC__StreamMetadata_StreamInfo &si);
     void handleVorbisComment(const FLAC__StreamMetadata_VorbisComment &vc);
     void handlePicture(const FLAC__StreamMetadata_Picture &pic);
+    void handleSeekTable(const FLAC__StreamMetadata_SeekTable &st);
+
+    bool isParallel() const { return m_bounds.size() > 0; }
+    void setupRanges();
+    void queueRanges();
+    size_t readSamplesParallel(void *buffer, size_t nsamples);
+    void seekToParallel(int64_t count);
+    void workerThreadProc();
 };
 
 #endif
@@ -0,0 +1,64 @@
+#ifndef _INDEPENDENTSOURCE_H
+#define _INDEPENDENTSOURCE_H
+
+#include "ISource.h"
+#include "InputFactory.h"
+
+/*
+ * Stands in for an already opened source, but reads through a decoder of
+ * its own which is opened on first use. Several of these can be read
+ * from different threads at once without sharing the file position.
+ * Format, length and tags are taken from the prototype.
+ */
+class IndependentSource: public ISeekableSource, public ITagParser {
+    std::string m_path;
+    int64_t m_position;
+    std::shared_ptr<ISeekableSource> m_proto;
+    std::shared_ptr<ISeekableSource> m_src;
+    std::map<std::string, std::string> m_emptyTags;
+public:
+    IndependentSource(const std::shared_ptr<ISeekableSource> &proto,
+                      const std::string &path)
+        : m_path(path), m_position(0), m_proto(proto)
+    {}
+    uint64_t length() const { return m_proto->length(); }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_proto->getSampleFormat();
+    }
+    const std::vector<uint32_t> *getChannels() const
+    {
+        return m_proto->getChannels();
+    }
+    int64_t getPosition() { return m_position; }
+    size_t readSamples(void *buffer, size_t nsamples)
+    {
+        if (!m_src.get()) {
+            m_src = InputFactory::instance().openUncached(m_path.c_str());
+            if (m_position)
+                m_src->seekTo(m_position);
+        }
+        nsamples = m_src->readSamples(buffer, nsamples);
+        m_position += nsamples;
+        return nsamples;
+    }
+    bool isSeekable() { return m_proto->isSeekable(); }
+    void seekTo(int64_t count)
+    {
+        if (m_src.get())
+            m_src->seekTo(count);
+        m_position = count;
+    }
+    const std::map<std::string, std::string> &getTags() const
+    {
+        ITagParser *parser = dynamic_cast<ITagParser*>(m_proto.get());
+        return parser ? parser->getTags() : m_emptyTags;
+    }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        ITagParser *parser = dynamic_cast<ITagParser*>(m_proto.get());
+        return parser ? parser->getArtworks() : ITagParser::getArtworks();
+    }
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <cstring> // strrchr
 #include <fcntl.h> // open
 #include <unistd.h> // lseek
+#include <sys/stat.h>
 #include "win32util.h"
 /*
 #ifdef QAAC
@@ -12,21 +13,240 @@
 #endif
 #include "FLACSource.h"
 #include "LibSndfileSource.h"
-#include "RawSource.h"
+#include "TakSource.h"
 */
+#include "RawSource.h"
+#include "SpooledSource.h"
 #include "WaveSource.h"
 /*
+#include "RangeParallelSource.h"
 #include "WavpackSource.h"
 #include "MP4Source.h"
 */
 
+namespace {
+    const size_t PROBE_SIZE = 0x1000;
+    const uint64_t DECODER_OVERHEAD = 256 << 10;
+    const int PIPE_SIZE = 1 << 20;
+
+    /* "-" is stdin, dup()'ed so that closing the input won't close it */
+    std::shared_ptr<FILE> open_file(const char *path)
+    {
+        int fd = std::strcmp(path, "-") ? ::open(path, O_RDONLY)
+                                        : dup(STDIN_FILENO);
+        if (fd == -1) {
+            // Handle file open error
+            throw std::runtime_error("Failed to open file");
+        }
+        std::shared_ptr<FILE> fp(fdopen(fd, "rb"), std::fclose);
+        if (!fp) {
+            // Handle file stream creation error
+            ::close(fd);
+            throw std::runtime_error("Failed to create file stream");
+        }
+        return fp;
+    }
+
+    /*
+     * The default 64KB pipe buffer has the writer (typically ffmpeg)
+     * stall on us far too often. Failure is harmless, so is ignored.
+     */
+    void grow_pipe(int fd)
+    {
+#ifdef F_SETPIPE_SZ
+        struct stat stb;
+        if (fstat(fd, &stb) == 0 && S_ISFIFO(stb.st_mode) &&
+            fcntl(fd, F_GETPIPE_SZ) < PIPE_SIZE)
+            fcntl(fd, F_SETPIPE_SZ, PIPE_SIZE);
+#endif
+    }
+
+    /*
+     * Tells the container from magic numbers in the first few KB,
+     * so that only the right reader has to be tried.
+     * Returns 0 when nothing is recognized.
+     */
+    uint32_t probe(const std::vector<uint8_t> &head)
+    {
+        const uint8_t *p = head.data();
+        size_t n = head.size();
+
+        if (n >= 10 && std::memcmp(p, "ID3", 3) == 0) {
+            size_t size = 0;
+            for (int i = 6; i < 10; ++i)
+                size = size << 7 | (p[i] & 0x7f);
+            size += 10;
+            if (p[5] & 0x10)
+                size += 10;
+            if (size + 4 <= n && std::memcmp(p + size, "fLaC", 4) == 0)
+                return 'fLaC';
+            return 'MPEG';
+        }
+        if (n < 12)
+            return 0;
+        if ((std::memcmp(p, "RIFF", 4) == 0 || std::memcmp(p, "RF64", 4) == 0)
+            && std::memcmp(p + 8, "WAVE", 4) == 0)
+            return 'WAVE';
+        if (std::memcmp(p, "fLaC", 4) == 0)
+            return 'fLaC';
+        if (std::memcmp(p, "OggS", 4) == 0) {
+            if (n >= 33 && std::memcmp(p + 28, "\177FLAC", 5) == 0)
+                return 'fLaC';
+            return 'OggS';
+        }
+        if (std::memcmp(p + 4, "ftyp", 4) == 0)
+            return 'ftyp';
+        if (std::memcmp(p, "wvpk", 4) == 0)
+            return 'wvpk';
+        if (std::memcmp(p, "tBaK", 4) == 0)
+            return 'tBaK';
+        if (std::memcmp(p, "caff", 4) == 0)
+            return 'caff';
+        if (std::memcmp(p, "FORM", 4) == 0)
+            return 'FORM';
+        if (p[0] == 0xff && (p[1] & 0xe0) == 0xe0)
+            return 'MPEG';
+        return 0;
+    }
+}
+
 std::shared_ptr<ISeekableSource> InputFactory::open(const char *path)
 {
-    std::map<std::string, std::shared_ptr<ISeekableSource> >::iterator
-        pos = m_sources.find(path);
-    if (pos != m_sources.end())
-        return pos->second;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto pos = m_sources.find(path);
+        if (pos != m_sources.end()) {
+            if (auto entry = pos->second.lock())
+                return std::make_shared<CachedSource>(entry);
+        }
+    }
+    /*
+     * Opening can take long (--spool-input copies a whole pipe), so it's
+     * done unlocked; m_mutex is only taken again to insert the entry.
+     */
+    auto src = openUncached(path);
+    auto entry = std::make_shared<Entry>();
+    entry->path = path;
+    entry->position = 0;
+    entry->seekable = src->isSeekable();
+    entry->length = src->length();
+    entry->asbd = src->getSampleFormat();
+    entry->has_channels = src->getChannels() != 0;
+    if (entry->has_channels)
+        entry->channels = *src->getChannels();
+    if (auto parser = dynamic_cast<ITagParser*>(src.get())) {
+        entry->tags = parser->getTags();
+        entry->artworks = parser->getArtworks();
+    }
+    if (auto parser = dynamic_cast<IChapterParser*>(src.get()))
+        entry->chapters = parser->getChapters();
+    /*
+     * A rough figure for what an open decoder pins: its buffers, plus
+     * its own copy of the tags. Artwork is shared with the entry, so
+     * doesn't go away with the decoder and is not counted.
+     */
+    entry->bytes = DECODER_OVERHEAD;
+    for (auto it = entry->tags.begin(); it != entry->tags.end(); ++it)
+        entry->bytes += it->first.size() + it->second.size();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    /* somebody else may have opened the same path in the meantime */
+    auto pos = m_sources.find(path);
+    if (pos != m_sources.end()) {
+        if (auto other = pos->second.lock())
+            return std::make_shared<CachedSource>(other);
+    }
+    entry->src = src;
+    entry->lru = m_lru.insert(m_lru.begin(), entry.get());
+    m_bytes += entry->bytes;
+    m_sources[path] = entry;
+    evict();
+    return std::make_shared<CachedSource>(entry);
+}
+
+ISeekableSource *InputFactory::acquire(Entry *entry)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (entry->src) {
+            m_lru.splice(m_lru.begin(), m_lru, entry->lru);
+            return entry->src.get();
+        }
+    }
+    /*
+     * Evicted: reopen unlocked. entry->mutex, held by the caller, keeps
+     * other users of the entry out, and evict() only looks at entries
+     * in m_lru, which this one is not.
+     */
+    auto src = openUncached(entry->path.c_str());
+    if (entry->position)
+        src->seekTo(entry->position);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    entry->src = src;
+    entry->lru = m_lru.insert(m_lru.begin(), entry);
+    m_bytes += entry->bytes;
+    evict();
+    return entry->src.get();
+}
+
+void InputFactory::forget(Entry *entry)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (entry->src) {
+        m_lru.erase(entry->lru);
+        m_bytes -= entry->bytes;
+    }
+}
+
+InputFactory::Entry::~Entry()
+{
+    InputFactory::instance().forget(this);
+}
+
+/*
+ * Closes least recently used decoders until we are within the limits.
+ * The most recent one is always kept, and so are decoders busy on other
+ * threads and the ones which could not be reopened.
+ */
+void InputFactory::evict()
+{
+    auto it = m_lru.end();
+    while ((m_lru.size() > m_max_open || m_bytes > m_max_bytes) &&
+           it != m_lru.begin() && --it != m_lru.begin()) {
+        Entry *e = *it;
+        if (!e->seekable || !e->mutex.try_lock())
+            continue;
+        e->position = e->src->getPosition();
+        e->src.reset();
+        e->mutex.unlock();
+        m_bytes -= e->bytes;
+        it = m_lru.erase(it);
+    }
+}
+
+std::shared_ptr<ISeekableSource> InputFactory::openUncached(const char *path)
+{
+    auto src = openFile(path);
+    if (m_spool_input && !src->isSeekable())
+        src = std::make_shared<SpooledSource>(src);
+    return src;
+}
+
+/*
+std::shared_ptr<ISeekableSource>
+InputFactory::parallelize(const std::shared_ptr<ISeekableSource> &src,
+                          const RangeParallelSource::opener_t &reopen,
+                          unsigned nthreads)
+{
+    if (nthreads < 2 || !src->isSeekable() || src->length() == ~0ULL)
+        return src;
+    return std::make_shared<RangeParallelSource>(src, reopen, nthreads);
+}
+*/
 
+std::shared_ptr<ISeekableSource> InputFactory::openFile(const char *path)
+{
     const char *ext = strrchr(path, '.');
     if (ext != nullptr) {
         // Move pointer to the position after the dot
@@ -36,59 +256,78 @@ std::shared_ptr<ISeekableSource> InputFactory::open(const char *path)
         ext = "";
     }
 
-    int fd = ::open(path, O_RDONLY);
-    if (fd == -1) {
-        // Handle file open error
-        throw std::runtime_error("Failed to open file");
-    }
-    std::shared_ptr<FILE> fp(fdopen(fd, "rb"));
-    if (!fp) {
-        // Handle file stream creation error
-        ::close(fd);
-        throw std::runtime_error("Failed to create file stream");
-    }
+    std::shared_ptr<FILE> fp = open_file(path);
+    int fd = fileno(fp.get());
+    grow_pipe(fd);
 
-/*
     if (m_is_raw) {
-        std::shared_ptr<RawSource> src =
-            std::make_shared<RawSource>(fp, m_raw_format);
-        m_sources[path] = src;
-        return src;
+        return std::make_shared<RawSource>(fp, m_raw_format);
     }
-*/
 
     if (strcasecmp(ext, "avs") == 0)
         throw std::runtime_error("not implemented: AvisynthSource");
 
+    std::vector<uint8_t> head(PROBE_SIZE);
+    ssize_t n = util::nread(fd, head.data(), head.size());
+    head.resize(n > 0 ? n : 0);
+    bool seekable = win32::is_seekable(fd);
+    uint32_t format = probe(head);
+
+    if (format == 'WAVE') {
+        try {
+            return std::make_shared<WaveSource>(fp, m_ignore_length, head);
+        } catch (...) {
+            if (!seekable)
+                throw;
+        }
+    }
+    if (!seekable)
+        throw std::runtime_error("Not available input file format");
+
 #define TRY_MAKE_SHARED(type, ...) \
     do { \
         try { \
-            std::shared_ptr<type> src = \
-                std::make_shared<type>(__VA_ARGS__); \
-            m_sources[path] = src; \
-            return src; \
+            CHECKCRT(lseek(fd, 0, SEEK_SET) < 0); \
+            return std::make_shared<type>(__VA_ARGS__); \
         } catch (...) { \
-            lseek(fd, 0, SEEK_SET); \
         } \
     } while (0)
 
-    TRY_MAKE_SHARED(WaveSource, fp, m_ignore_length);
-    // Check if the file is seekable
-    if (lseek(fd, 0, SEEK_CUR) == -1) {
-        ::close(fd);
-        throw std::runtime_error("Not available input file format");
-    }
-
 /*
-    TRY_MAKE_SHARED(MP4Source, fp);
+    // reopen is evaluated on a worker thread, for each extra decoder
+#define TRY_MAKE_PARALLEL(type, arg, reopen) \
+    do { \
+        try { \
+            CHECKCRT(lseek(fd, 0, SEEK_SET) < 0); \
+            return parallelize(std::make_shared<type>(arg), \
+                               [=] { return std::make_shared<type>(reopen); }, \
+                               nthreads); \
+        } catch (...) { \
+        } \
+    } while (0)
+
+    std::string spath(path);
+    // a probe only reads headers, no use starting decoder threads;
+    // openProbe() has to tell openFile() so again once this is enabled
+    unsigned nthreads = probing ? 1 : m_decode_threads;
+
+    switch (format) {
+    case 'fLaC': TRY_MAKE_SHARED(FLACSource, fp, nthreads); break;
+    case 'ftyp': TRY_MAKE_SHARED(MP4Source, fp); break;
+    case 'wvpk':
+        TRY_MAKE_PARALLEL(WavpackSource, spath, spath);
+        break;
+    case 'tBaK':
+        TRY_MAKE_PARALLEL(TakSource, fp, open_file(spath.c_str()));
+        break;
+    }
+    // No signature matched, or the dedicated reader refused the file:
+    // leave it to the general purpose libraries.
 #ifdef QAAC
     TRY_MAKE_SHARED(ExtAFSource, fp);
 #endif
-    TRY_MAKE_SHARED(FLACSource, fp);
-    TRY_MAKE_SHARED(WavpackSource, path);
     TRY_MAKE_SHARED(LibSndfileSource, fp);
 */
 
-    ::close(fd);
     throw std::runtime_error("Not available input file format");
 }
@@ -1,15 +1,52 @@
 #ifndef INPUTFACTORY_H
 #define INPUTFACTORY_H
 
+#include <list>
+#include <mutex>
 #include "ISource.h"
 
 class InputFactory {
+public:
+    /*
+     * Decoder shared by every handle open() returned for the same path.
+     * Format, length and tags are kept here, so that the decoder itself
+     * can be closed when the cache runs over its limits.
+     */
+    struct Entry {
+        std::string path;
+        std::mutex mutex; /* held while the decoder is in use */
+        std::shared_ptr<ISeekableSource> src; /* null while evicted */
+        int64_t position; /* where to resume after reopening */
+        uint64_t bytes;
+        bool seekable;
+        uint64_t length;
+        AudioStreamBasicDescription asbd;
+        bool has_channels;
+        std::vector<uint32_t> channels;
+        std::map<std::string, std::string> tags;
+        std::vector<misc::blob_t> artworks;
+        std::vector<misc::chapter_t> chapters;
+        std::list<Entry*>::iterator lru;
+        ~Entry();
+    };
+private:
     AudioStreamBasicDescription m_raw_format;
     bool m_is_raw;
     bool m_ignore_length;
-    std::map<std::string, std::shared_ptr<ISeekableSource> > m_sources;
+    unsigned m_decode_threads;
+    bool m_spool_input;
+    size_t m_max_open;
+    uint64_t m_max_bytes;
+    uint64_t m_bytes;
+    std::mutex m_mutex;
+    std::map<std::string, std::weak_ptr<Entry> > m_sources;
+    std::list<Entry*> m_lru; /* entries with an open decoder, recent first */
 private:
-    InputFactory() : m_is_raw(false), m_ignore_length(false) {}
+    InputFactory()
+        : m_is_raw(false), m_ignore_length(false), m_decode_threads(1),
+          m_spool_input(false),
+          m_max_open(16), m_max_bytes(256 << 20), m_bytes(0)
+    {}
     InputFactory(const InputFactory&);
     InputFactory& operator=(InputFactory&);
 public:
@@ -18,7 +55,25 @@ public:
         static InputFactory self;
         return self;
     }
+    /*
+     * Returns a handle to a cached decoder. Repeated opens of the same
+     * path share the decoder, as cue sheets rely on.
+     */
     std::shared_ptr<ISeekableSource> open(const char *path);
+    /*
+     * Opens a new decoder instance which is not shared with anyone.
+     * Doesn't touch the cache, so it's safe to call from worker threads
+     * once the factory has been set up.
+     */
+    std::shared_ptr<ISeekableSource> openUncached(const char *path);
+    /*
+     * Opens a private decoder only to read format, length and tags.
+     * Unlike openUncached(), a pipe is not spooled.
+     */
+    std::shared_ptr<ISeekableSource> openProbe(const char *path)
+    {
+        return openFile(path);
+    }
     void setRawFormat(const AudioStreamBasicDescription &asbd)
     {
         m_raw_format = asbd;
@@ -28,10 +83,110 @@ public:
     {
         m_ignore_length = cond;
     }
+    /* number of threads a decoder may use, where it supports that */
+    void setDecodeThreads(unsigned n)
+    {
+        m_decode_threads = n;
+    }
+    /* make non-seekable inputs seekable by spooling them */
+    void setSpoolInput(bool cond)
+    {
+        m_spool_input = cond;
+    }
+    /* limits on decoders kept open by the cache */
+    void setCacheLimits(size_t max_open, uint64_t max_bytes)
+    {
+        m_max_open = max_open;
+        m_max_bytes = max_bytes;
+    }
     void close()
     {
+        std::lock_guard<std::mutex> lock(m_mutex);
         m_sources.clear();
     }
+    /* the following are for CachedSource; entry->mutex must be held */
+    ISeekableSource *acquire(Entry *entry);
+    void forget(Entry *entry);
+private:
+    std::shared_ptr<ISeekableSource> openFile(const char *path);
+    /*
+     * With decode threads, has decoders with sample exact seeking read
+     * ranges of the stream in parallel. reopen makes another decoder.
+     * Only the WavPack and TAK readers use it, which are not built yet.
+    std::shared_ptr<ISeekableSource>
+        parallelize(const std::shared_ptr<ISeekableSource> &src,
+                    const std::function<
+                        std::shared_ptr<ISeekableSource>()> &reopen,
+                    unsigned nthreads);
+     */
+    void evict();
+};
+
+/*
+ * What InputFactory::open() hands out. Reads go through the shared
+ * decoder, which is reopened and put back at the position it was left
+ * if the factory closed it in the meantime.
+ */
+class CachedSource: public ISeekableSource, public ITagParser,
+    public IChapterParser, public IBorrowableSource
+{
+    std::shared_ptr<InputFactory::Entry> m_entry;
+    /* what we last borrowed from, kept alive even if evicted */
+    std::shared_ptr<ISeekableSource> m_lender;
+    std::vector<uint8_t> m_pivot;
+public:
+    explicit CachedSource(const std::shared_ptr<InputFactory::Entry> &entry)
+        : m_entry(entry)
+    {}
+    uint64_t length() const { return m_entry->length; }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_entry->asbd;
+    }
+    const std::vector<uint32_t> *getChannels() const
+    {
+        return m_entry->has_channels ? &m_entry->channels : 0;
+    }
+    int64_t getPosition()
+    {
+        std::lock_guard<std::mutex> lock(m_entry->mutex);
+        return m_entry->src ? m_entry->src->getPosition()
+                            : m_entry->position;
+    }
+    size_t readSamples(void *buffer, size_t nsamples)
+    {
+        std::lock_guard<std::mutex> lock(m_entry->mutex);
+        ISeekableSource *src = InputFactory::instance().acquire(m_entry.get());
+        return src->readSamples(buffer, nsamples);
+    }
+    size_t borrowSamples(const void **data, size_t nsamples)
+    {
+        std::lock_guard<std::mutex> lock(m_entry->mutex);
+        InputFactory::instance().acquire(m_entry.get());
+        m_lender = m_entry->src;
+        return ::borrowSamples(m_lender.get(), &m_pivot, data, nsamples);
+    }
+    bool isSeekable() { return m_entry->seekable; }
+    void seekTo(int64_t count)
+    {
+        std::lock_guard<std::mutex> lock(m_entry->mutex);
+        if (m_entry->src)
+            m_entry->src->seekTo(count);
+        else
+            m_entry->position = count;
+    }
+    const std::map<std::string, std::string> &getTags() const
+    {
+        return m_entry->tags;
+    }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        return m_entry->artworks;
+    }
+    const std::vector<misc::chapter_t> &getChapters() const
+    {
+        return m_entry->chapters;
+    }
 };
 
 #endif
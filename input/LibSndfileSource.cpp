@@ -177,6 +177,7 @@ LibSndfileSource::LibSndfileSource(const std::shared_ptr<FILE> &fp)
         m_tags = CAF::fetchTags(fileno(m_fp.get()));
     else if (m_format_name == "oga")
         fetchVorbisTags(p->subtype);
+    misc::moveArtwork(&m_tags, &m_artworks);
 }
 
 void LibSndfileSource::seekTo(int64_t count)
@@ -223,7 +224,7 @@ void LibSndfileSource::fetchVorbisTags(int codec)
     for (auto it = pics.begin(); it != pics.end(); ++it) {
         if ((*it)->type() == TagLib::FLAC::Picture::FrontCover) {
             auto data = (*it)->data();
-            m_tags["COVER ART"] = std::string(data.begin(), data.end());
+            m_artworks.push_back(misc::internBlob(data.data(), data.size()));
         }
     }
 }
@@ -49,6 +49,7 @@ class LibSndfileSource: public ISeekableSource, public ITagParser
     std::shared_ptr<FILE> m_fp;
     std::vector<uint32_t> m_chanmap;
     std::map<std::string, std::string> m_tags;
+    std::vector<misc::blob_t> m_artworks;
     LibSndfileModule &m_module;
     AudioStreamBasicDescription m_asbd;
     sf_count_t (*m_readf)(SNDFILE *, void *, sf_count_t);
@@ -73,6 +74,10 @@ public:
     void seekTo(int64_t count);
     int64_t getPosition();
     const std::map<std::string, std::string> &getTags() const { return m_tags; }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        return m_artworks;
+    }
 private:
     void fetchVorbisTags(int codec);
 };
@@ -61,6 +61,7 @@ MP4Source::MP4Source(const std::shared_ptr<FILE> &fp)
 
         m_decode_buffer.set_unit(m_oasbd.mBytesPerFrame);
         m_tags = M4A::fetchTags(m_file);
+        misc::moveArtwork(&m_tags, &m_artworks);
         if (m_file.FindTrackAtom(m_track_id, "edts.elst")) {
             uint32_t nedits = m_file.GetTrackNumberOfEdits(m_track_id);
             for (uint32_t i = 1; i <= nedits; ++i) {
@@ -143,8 +144,18 @@ size_t MP4Source::readSamples(void *buffer, size_t nsamples)
             MP4Duration delta =
                 m_file.GetSampleDuration(m_track_id, m_current_packet + 1);
             ssize_t nframes = static_cast<ssize_t>(delta * m_time_ratio + .5);
-            m_decode_buffer.reserve(nframes);
-            nframes = m_decoder->decode(m_decode_buffer.write_ptr(), nframes);
+            /*
+             * A whole packet with nothing to skip at the start goes
+             * straight into the caller's buffer. Trimming at the end of
+             * an edit only shortens it.
+             */
+            bool direct = !m_start_skip &&
+                          nsamples >= static_cast<size_t>(nframes);
+            if (!direct)
+                m_decode_buffer.reserve(nframes);
+            nframes = m_decoder->decode(direct ? buffer
+                                               : m_decode_buffer.write_ptr(),
+                                        nframes);
             m_position_raw += nframes;
             int64_t trim = std::max(m_position_raw
                                     - m_edits.mediaOffset(edit)
@@ -153,6 +164,12 @@ size_t MP4Source::readSamples(void *buffer, size_t nsamples)
                                     static_cast<int64_t>(0));
             if (trim > 0)
                 nframes -= trim;
+            if (direct) {
+                if (nframes <= 0)
+                    return 0;
+                m_position += nframes;
+                return nframes;
+            }
             if (nframes > 0)
                 m_decode_buffer.commit(nframes);
             if (!m_decode_buffer.count())
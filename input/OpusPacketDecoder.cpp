@@ -115,11 +115,21 @@ size_t OpusPacketDecoder::decode(void *data, size_t nsamples)
 {
     if (m_decoder && m_feeder->feed(&m_packet_buffer)) {
         int fpp = m_module.packet_get_nb_samples(m_packet_buffer.data(), m_packet_buffer.size(), 48000);
+        if (fpp < 0) throw std::runtime_error(m_module.strerror(fpp));
+        if (!m_decode_buffer.count() && nsamples >= static_cast<size_t>(fpp)) {
+            int nc = m_module.multistream_decode_float(m_decoder.get(),
+                m_packet_buffer.data(),
+                m_packet_buffer.size(),
+                static_cast<float*>(data), fpp, 0);
+            if (nc < 0) throw std::runtime_error(m_module.strerror(nc));
+            return nc;
+        }
         m_decode_buffer.reserve(fpp * m_iasbd.mChannelsPerFrame);
         int nc = m_module.multistream_decode_float(m_decoder.get(),
             m_packet_buffer.data(),
             m_packet_buffer.size(),
-            m_decode_buffer.write_ptr(), fpp * m_iasbd.mChannelsPerFrame, 0);
+            m_decode_buffer.write_ptr(), fpp, 0);
+        if (nc < 0) throw std::runtime_error(m_module.strerror(nc));
         m_decode_buffer.commit(nc * m_iasbd.mChannelsPerFrame);
         nsamples = std::min(nsamples, (size_t)(m_decode_buffer.count() / m_iasbd.mChannelsPerFrame));
         std::memcpy(data, m_decode_buffer.read_ptr(), nsamples * m_iasbd.mChannelsPerFrame * sizeof(float));
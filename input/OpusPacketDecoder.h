@@ -3,6 +3,7 @@
 
 #include <memory>
 #include "PacketDecoder.h"
+#include "util.h"
 #include "dl.h"
 #include <opus_multistream.h>
 
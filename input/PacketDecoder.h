@@ -14,6 +14,12 @@ struct IPacketDecoder {
     virtual void reset() = 0;
     virtual const AudioStreamBasicDescription &getSampleFormat() = 0;
     virtual void setMagicCookie(const std::vector<uint8_t> &cookie) = 0;
+    /*
+     * Decodes the next packet. When nothing is left over from earlier
+     * packets and nsamples covers the whole packet, it is written straight
+     * into data. Otherwise the output is buffered, and as much of it as
+     * fits is returned.
+     */
     virtual size_t decode(void *data, size_t nsamples) = 0;
 };
 
@@ -0,0 +1,141 @@
+#include <cstring>
+#include "RangeParallelSource.h"
+
+RangeParallelSource::RangeParallelSource(
+        const std::shared_ptr<ISeekableSource> &proto, const opener_t &reopen,
+        unsigned nthreads, uint64_t range_size)
+    : m_proto(proto), m_reopen(reopen), m_nthreads(std::max(nthreads, 1U)),
+      m_range_size(std::max(range_size, static_cast<uint64_t>(1))),
+      m_next_start(0), m_position(0), m_range_offset(0), m_quit(false)
+{
+    if (proto->length() == ~0ULL)
+        throw std::runtime_error("RangeParallelSource: length is unknown");
+}
+
+RangeParallelSource::~RangeParallelSource()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+}
+
+void RangeParallelSource::queueRanges()
+{
+    if (m_workers.empty()) {
+        for (unsigned i = 0; i < m_nthreads; ++i)
+            m_workers.emplace_back(&RangeParallelSource::workerThreadProc,
+                                   this, i);
+    }
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (m_ranges.size() < 2 * m_nthreads &&
+               m_next_start < length()) {
+            auto range = std::make_shared<Range>();
+            range->start = m_next_start;
+            /* the first range after a seek ends on a range boundary */
+            uint64_t end = (m_next_start / m_range_size + 1) * m_range_size;
+            range->count = std::min(end, length()) - m_next_start;
+            range->nsamples = 0;
+            range->ready = false;
+            m_next_start += range->count;
+            m_ranges.push_back(range);
+            m_jobs.push_back(range);
+            queued = true;
+        }
+    }
+    if (queued)
+        m_cond.notify_all();
+}
+
+size_t RangeParallelSource::readSamples(void *buffer, size_t nsamples)
+{
+    if (!nsamples)
+        return 0;
+    for (;;) {
+        queueRanges();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_ranges.empty())
+            return 0;
+        std::shared_ptr<Range> range = m_ranges.front();
+        m_cond.wait(lock, [&] { return range->ready; });
+        if (range->error)
+            std::rethrow_exception(range->error);
+        lock.unlock();
+
+        uint32_t bpf = getSampleFormat().mBytesPerFrame;
+        size_t count = std::min(range->nsamples - m_range_offset, nsamples);
+        std::memcpy(buffer, &range->data[m_range_offset * bpf], count * bpf);
+        m_range_offset += count;
+        m_position += count;
+        if (m_range_offset == range->nsamples) {
+            lock.lock();
+            m_ranges.pop_front();
+            /* a short range means the stream ended early */
+            if (range->nsamples < range->count) {
+                m_ranges.clear();
+                m_jobs.clear();
+                m_next_start = length();
+            }
+            lock.unlock();
+            m_range_offset = 0;
+        }
+        if (count)
+            return count;
+    }
+}
+
+void RangeParallelSource::seekTo(int64_t count)
+{
+    if (count < 0 || static_cast<uint64_t>(count) > length())
+        throw std::runtime_error("RangeParallelSource: invalid seek offset");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    /* ranges still being decoded are simply thrown away when done */
+    m_ranges.clear();
+    m_jobs.clear();
+    m_next_start = count;
+    m_range_offset = 0;
+    m_position = count;
+}
+
+void RangeParallelSource::workerThreadProc(unsigned n)
+{
+    /* the first worker borrows the prototype instead of opening another */
+    std::shared_ptr<ISeekableSource> decoder;
+    if (n == 0)
+        decoder = m_proto;
+    for (;;) {
+        std::shared_ptr<Range> range;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&] { return m_quit || m_jobs.size(); });
+            if (m_quit)
+                break;
+            range = m_jobs.front();
+            m_jobs.pop_front();
+        }
+        try {
+            if (!decoder)
+                decoder = m_reopen();
+            if (decoder->getPosition() != static_cast<int64_t>(range->start))
+                decoder->seekTo(range->start);
+            range->data.resize(range->count * getSampleFormat().mBytesPerFrame);
+            range->nsamples = readSamplesFull(decoder.get(),
+                                              range->data.data(),
+                                              range->count);
+        } catch (...) {
+            range->error = std::current_exception();
+            if (decoder != m_proto)
+                decoder.reset();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            range->ready = true;
+        }
+        m_cond.notify_all();
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef RANGE_PARALLEL_SOURCE_H
+#define RANGE_PARALLEL_SOURCE_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+#include "ISource.h"
+
+/*
+ * Decodes a seekable source on worker threads. The stream is cut into
+ * ranges of a fixed number of samples, each of which is decoded by one of
+ * several instances of the decoder and handed out in order.
+ *
+ * Only for decoders with sample exact seeking: every range starts with a
+ * seek. reopen() must return a new, independent instance of the decoder
+ * the prototype was made by.
+ */
+class RangeParallelSource: public ISeekableSource, public ITagParser,
+    public IChapterParser
+{
+public:
+    typedef std::function<std::shared_ptr<ISeekableSource>()> opener_t;
+private:
+    struct Range {
+        uint64_t start, count;
+        std::vector<uint8_t> data;
+        size_t nsamples;
+        bool ready;
+        std::exception_ptr error;
+    };
+    std::shared_ptr<ISeekableSource> m_proto;
+    opener_t m_reopen;
+    unsigned m_nthreads;
+    uint64_t m_range_size;
+    uint64_t m_next_start;
+    int64_t m_position;
+    size_t m_range_offset;
+    std::deque<std::shared_ptr<Range> > m_ranges;
+    std::deque<std::shared_ptr<Range> > m_jobs;
+    bool m_quit;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<std::thread> m_workers;
+    std::map<std::string, std::string> m_emptyTags;
+    std::vector<misc::chapter_t> m_emptyChapters;
+public:
+    RangeParallelSource(const std::shared_ptr<ISeekableSource> &proto,
+                        const opener_t &reopen, unsigned nthreads,
+                        uint64_t range_size=1<<18);
+    ~RangeParallelSource();
+    uint64_t length() const { return m_proto->length(); }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_proto->getSampleFormat();
+    }
+    const std::vector<uint32_t> *getChannels() const
+    {
+        return m_proto->getChannels();
+    }
+    int64_t getPosition() { return m_position; }
+    size_t readSamples(void *buffer, size_t nsamples);
+    bool isSeekable() { return true; }
+    void seekTo(int64_t count);
+    const std::map<std::string, std::string> &getTags() const
+    {
+        ITagParser *parser = dynamic_cast<ITagParser*>(m_proto.get());
+        return parser ? parser->getTags() : m_emptyTags;
+    }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        ITagParser *parser = dynamic_cast<ITagParser*>(m_proto.get());
+        return parser ? parser->getArtworks() : ITagParser::getArtworks();
+    }
+    const std::vector<misc::chapter_t> &getChapters() const
+    {
+        IChapterParser *parser = dynamic_cast<IChapterParser*>(m_proto.get());
+        return parser ? parser->getChapters() : m_emptyChapters;
+    }
+private:
+    void queueRanges();
+    void workerThreadProc(unsigned n);
+};
+
+#endif
@@ -2,14 +2,22 @@
 #include "win32util.h"
 #include "cautil.h"
 
+namespace {
+    /* piece size when skipping forward on a pipe */
+    const int64_t SKIP_CHUNK = 1 << 20;
+}
+
 RawSource::RawSource(const std::shared_ptr<FILE> &fp,
                      const AudioStreamBasicDescription &asbd)
     : m_position(0), m_fp(fp), m_asbd(asbd)
 {
-    if (isSeekable())
-        m_length = _filelengthi64(fileno(m_fp.get())) / asbd.mBytesPerFrame;
+    bool seekable = isSeekable();
+    if (seekable)
+        m_length = win32::filelengthi64(fileno(m_fp.get()))
+                        / asbd.mBytesPerFrame;
     else
         m_length = ~0ULL;
+    m_reader = std::make_shared<AsyncReader>(fileno(m_fp.get()), 0, seekable);
     bool isfloat = asbd.mFormatFlags & kAudioFormatFlagIsFloat;
     m_oasbd = cautil::buildASBDForPCM2(asbd.mSampleRate,
                                        asbd.mChannelsPerFrame,
@@ -21,11 +29,11 @@ RawSource::RawSource(const std::shared_ptr<FILE> &fp,
 
 size_t RawSource::readSamples(void *buffer, size_t nsamples)
 {
-    ssize_t nbytes = nsamples * m_asbd.mBytesPerFrame;
+    size_t nbytes = nsamples * m_asbd.mBytesPerFrame;
     if (m_buffer.size() < nbytes)
         m_buffer.resize(nbytes);
-    nbytes = util::nread(fileno(m_fp.get()), &m_buffer[0], nbytes);
-    nsamples = nbytes > 0 ? nbytes / m_asbd.mBytesPerFrame : 0;
+    ssize_t n = m_reader->read(&m_buffer[0], nbytes);
+    nsamples = n > 0 ? n / m_asbd.mBytesPerFrame : 0;
     if (nsamples) {
         size_t size = nsamples * m_asbd.mBytesPerFrame;
 
@@ -51,18 +59,21 @@ size_t RawSource::readSamples(void *buffer, size_t nsamples)
 
 void RawSource::seekTo(int64_t count)
 {
-    int fd = fileno(m_fp.get());
     if (isSeekable()) {
-        CHECKCRT(lseek(fd, count*m_asbd.mBytesPerFrame, SEEK_SET) < 0);
+        m_reader->seek(count * m_asbd.mBytesPerFrame);
         m_position = count;
     } else if (m_position > count) {
         throw std::runtime_error("Cannot seek back the input");
     } else {
         int64_t bytes = (count - m_position) * m_asbd.mBytesPerFrame;
         int64_t nread = 0;
-        char buf[0x1000];
+        size_t chunk = std::min(bytes, SKIP_CHUNK);
+        if (m_buffer.size() < chunk)
+            m_buffer.resize(chunk);
         while (nread < bytes) {
-            int n = util::nread(fd, buf, std::min(bytes - nread, 0x1000LL));
+            ssize_t n = m_reader->read(m_buffer.data(),
+                                       std::min(bytes - nread,
+                                                int64_t(chunk)));
             if (n <= 0) break;
             nread += n;
         }
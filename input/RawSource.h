@@ -3,11 +3,13 @@
 
 #include "ISource.h"
 #include "win32util.h"
+#include "AsyncReader.h"
 
 class RawSource: public ISeekableSource {
     uint64_t m_length;
     int64_t m_position;
     std::shared_ptr<FILE> m_fp;
+    std::shared_ptr<AsyncReader> m_reader;
     std::vector<uint8_t> m_buffer;
     AudioStreamBasicDescription m_asbd, m_oasbd;
 public:
@@ -0,0 +1,80 @@
+#include <cerrno>
+#include <unistd.h>
+#include "SpooledSource.h"
+#include "win32util.h"
+
+namespace {
+    const size_t NSAMPLES = 0x4000;
+}
+
+SpooledSource::SpooledSource(const std::shared_ptr<ISource> &src)
+    : m_src(src), m_spooled(0), m_position(0)
+{
+    m_spool = win32::tmpfile("qaac.spool");
+}
+
+size_t SpooledSource::readSamples(void *buffer, size_t nsamples)
+{
+    if (static_cast<uint64_t>(m_position) < m_spooled)
+        return readSpool(buffer, nsamples);
+
+    uint32_t bpf = getSampleFormat().mBytesPerFrame;
+    int fd = fileno(m_spool.get());
+    nsamples = m_src->readSamples(buffer, nsamples);
+    if (nsamples) {
+        win32::tmpfile_reserve(fd, (m_spooled + nsamples) * bpf);
+        const uint8_t *bp = static_cast<const uint8_t*>(buffer);
+        size_t size = nsamples * bpf, done = 0;
+        while (done < size) {
+            ssize_t rc = pwrite(fd, bp + done, size - done,
+                                m_spooled * bpf + done);
+            if (rc < 0 && errno == EINTR)
+                continue;
+            if (rc < 0)
+                util::throw_crt_error("pwrite()");
+            done += rc;
+        }
+        m_spooled += nsamples;
+        m_position += nsamples;
+    }
+    return nsamples;
+}
+
+void SpooledSource::seekTo(int64_t count)
+{
+    if (count < 0)
+        throw std::runtime_error("SpooledSource: invalid seek offset");
+    m_position = std::min(static_cast<uint64_t>(count), m_spooled);
+    if (m_spooled >= static_cast<uint64_t>(count))
+        return;
+    uint32_t bpf = getSampleFormat().mBytesPerFrame;
+    m_buffer.resize(NSAMPLES * bpf);
+    while (static_cast<uint64_t>(m_position) < static_cast<uint64_t>(count)) {
+        size_t n = std::min(static_cast<uint64_t>(NSAMPLES),
+                            static_cast<uint64_t>(count - m_position));
+        if (!readSamples(m_buffer.data(), n))
+            break;
+    }
+}
+
+size_t SpooledSource::readSpool(void *buffer, size_t nsamples)
+{
+    uint32_t bpf = getSampleFormat().mBytesPerFrame;
+    nsamples = std::min(static_cast<uint64_t>(nsamples),
+                        m_spooled - m_position);
+    uint8_t *bp = static_cast<uint8_t*>(buffer);
+    size_t size = nsamples * bpf, done = 0;
+    while (done < size) {
+        ssize_t rc = pread(fileno(m_spool.get()), bp + done, size - done,
+                           m_position * bpf + done);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0)
+            util::throw_crt_error("pread()");
+        if (rc == 0)
+            throw std::runtime_error("SpooledSource: spool file is truncated");
+        done += rc;
+    }
+    m_position += nsamples;
+    return nsamples;
+}
@@ -0,0 +1,47 @@
+#ifndef SPOOLED_SOURCE_H
+#define SPOOLED_SOURCE_H
+
+#include "ISource.h"
+
+/*
+ * Makes a non-seekable source seekable by copying whatever is read from
+ * it to a temporary file. Seeking back is served from the copy; seeking
+ * forward reads (and copies) the source up to there.
+ */
+class SpooledSource: public ISeekableSource, public ITagParser {
+    std::shared_ptr<ISource> m_src;
+    std::shared_ptr<FILE> m_spool;
+    uint64_t m_spooled;
+    int64_t m_position;
+    std::vector<uint8_t> m_buffer;
+    std::map<std::string, std::string> m_emptyTags;
+public:
+    explicit SpooledSource(const std::shared_ptr<ISource> &src);
+    uint64_t length() const { return m_src->length(); }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_src->getSampleFormat();
+    }
+    const std::vector<uint32_t> *getChannels() const
+    {
+        return m_src->getChannels();
+    }
+    int64_t getPosition() { return m_position; }
+    size_t readSamples(void *buffer, size_t nsamples);
+    bool isSeekable() { return true; }
+    void seekTo(int64_t count);
+    const std::map<std::string, std::string> &getTags() const
+    {
+        ITagParser *parser = dynamic_cast<ITagParser*>(m_src.get());
+        return parser ? parser->getTags() : m_emptyTags;
+    }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        ITagParser *parser = dynamic_cast<ITagParser*>(m_src.get());
+        return parser ? parser->getArtworks() : ITagParser::getArtworks();
+    }
+private:
+    size_t readSpool(void *buffer, size_t nsamples);
+};
+
+#endif
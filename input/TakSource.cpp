@@ -192,5 +192,6 @@ void TakSource::fetchTags()
         }
     }
     m_tags = TextBasedTag::normalizeTags(tags);
-    if (cover.size()) m_tags["COVER ART"] = cover;
+    if (cover.size())
+        m_artworks.push_back(misc::internBlob(cover.data(), cover.size()));
 }
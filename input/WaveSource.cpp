@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include "WaveSource.h"
 #include "util.h"
 #include "win32util.h"
@@ -11,6 +12,13 @@
 
 #define FOURCCR(a,b,c,d) ((a)|((b)<<8)|((c)<<16)|((d)<<24))
 
+namespace {
+    /* how far ahead of the reader the mapping is prefaulted */
+    const size_t MAP_WINDOW = 8 << 20;
+    /* piece size when skipping forward on a pipe */
+    const int64_t SKIP_CHUNK = 1 << 20;
+}
+
 namespace wave {
     const GUID ksFormatSubTypePCM = {
         0x1, 0x0, 0x10, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 }
@@ -20,11 +28,21 @@ namespace wave {
     };
 }
 
-WaveSource::WaveSource(const std::shared_ptr<FILE> &fp, bool ignorelength)
-    : m_data_pos(0), m_position(0), m_fp(fp)
+WaveSource::WaveSource(const std::shared_ptr<FILE> &fp, bool ignorelength,
+                       const std::vector<uint8_t> &head)
+    : m_data_pos(0), m_position(0), m_offset(0), m_fp(fp), m_map_size(0),
+      m_advised(0), m_data(0), m_mapped(0), m_head(head), m_head_pos(0)
 {
     std::memset(&m_asbd, 0, sizeof m_asbd);
     m_seekable = win32::is_seekable(fileno(m_fp.get()));
+    if (m_seekable)
+        m_offset = lseek(fd(), 0, SEEK_CUR) - m_head.size();
+    if (m_head.empty()) {
+        /* read headers in one go instead of field by field */
+        m_head.resize(0x1000);
+        ssize_t n = util::nread(fd(), m_head.data(), m_head.size());
+        m_head.resize(n > 0 ? n : 0);
+    }
     int64_t data_length = parse();
     if (ignorelength || !data_length || data_length % m_block_align)
         m_length = ~0ULL;
@@ -32,7 +50,10 @@ WaveSource::WaveSource(const std::shared_ptr<FILE> &fp, bool ignorelength)
         m_length = data_length / m_block_align;
     if (m_seekable) {
         int fd = fileno(m_fp.get());
-        m_data_pos = lseek(fd, 0, SEEK_CUR);
+        m_data_pos = m_offset;
+        CHECKCRT(lseek(fd, m_data_pos, SEEK_SET) < 0);
+        m_head.clear();
+        m_head_pos = 0;
         if (m_length == ~0ULL) {
             int64_t file_size = win32::filelengthi64(fd);
             if (file_size == -1) {
@@ -43,6 +64,54 @@ WaveSource::WaveSource(const std::shared_ptr<FILE> &fp, bool ignorelength)
             }
         }
     }
+    /*
+     * With --ignorelength the file may still be growing, which a
+     * mapping wouldn't follow.
+     */
+    if (!m_seekable || ignorelength || !map())
+        m_reader = std::make_shared<AsyncReader>(fd(), m_data_pos,
+                                                 m_seekable);
+}
+
+bool WaveSource::map()
+{
+    int64_t file_size = win32::filelengthi64(fd());
+    if (file_size <= m_data_pos || m_length == ~0ULL)
+        return false;
+    /* don't map past the end of a truncated file */
+    m_mapped = std::min(m_length, static_cast<uint64_t>(file_size - m_data_pos)
+                                    / m_block_align);
+    if (!m_mapped)
+        return false;
+    int64_t page = sysconf(_SC_PAGESIZE);
+    int64_t base = m_data_pos & ~(page - 1);
+    size_t size = m_data_pos - base + m_mapped * m_block_align;
+    void *p = mmap(0, size, PROT_READ, MAP_SHARED, fd(), base);
+    if (p == MAP_FAILED)
+        return false;
+    m_map.reset(p, [size](void *p) { munmap(p, size); });
+    m_map_size = size;
+    m_data = static_cast<uint8_t*>(p) + (m_data_pos - base);
+    madvise(p, size, MADV_SEQUENTIAL);
+    return true;
+}
+
+/*
+ * Frames at the current position in the mapping. Keeps asking the kernel
+ * for the next window before the reader gets there, so that page faults
+ * seldom have to wait on the storage.
+ */
+const uint8_t *WaveSource::mapped(size_t nsamples)
+{
+    uint8_t *base = static_cast<uint8_t*>(m_map.get());
+    const uint8_t *bp = m_data + m_position * m_block_align;
+    size_t end = bp - base + nsamples * m_block_align;
+    if (end + MAP_WINDOW / 2 > m_advised && m_advised < m_map_size) {
+        size_t len = std::min(MAP_WINDOW, m_map_size - m_advised);
+        madvise(base + m_advised, len, MADV_WILLNEED);
+        m_advised += len;
+    }
+    return bp;
 }
 
 size_t WaveSource::readSamples(void *buffer, size_t nsamples)
@@ -51,14 +120,21 @@ size_t WaveSource::readSamples(void *buffer, size_t nsamples)
         nsamples = static_cast<size_t>(std::min(static_cast<uint64_t>(nsamples),
                                                 m_length - m_position));
     }
-    ssize_t nbytes = nsamples * m_block_align;
-    if (m_buffer.size() < nbytes)
-        m_buffer.resize(nbytes);
-    nbytes = util::nread(fd(), &m_buffer[0], nbytes);
-    nsamples = nbytes > 0 ? nbytes / m_block_align: 0;
+    const uint8_t *bp;
+    if (m_map) {
+        nsamples = std::min(static_cast<uint64_t>(nsamples), mappedLeft());
+        bp = mapped(nsamples);
+    } else {
+        ssize_t nbytes = nsamples * m_block_align;
+        if (m_buffer.size() < static_cast<size_t>(nbytes))
+            m_buffer.resize(nbytes);
+        nbytes = read(&m_buffer[0], nbytes);
+        nsamples = nbytes > 0 ? nbytes / m_block_align: 0;
+        bp = &m_buffer[0];
+    }
     if (nsamples) {
         size_t size = nsamples * m_block_align;
-        util::unpack(&m_buffer[0], buffer, &size,
+        util::unpack(bp, buffer, &size,
                      m_block_align / m_asbd.mChannelsPerFrame,
                      m_asbd.mBytesPerFrame / m_asbd.mChannelsPerFrame);
         /* convert to signed */
@@ -70,28 +146,85 @@ size_t WaveSource::readSamples(void *buffer, size_t nsamples)
     }
     return nsamples;
 }
+
+/*
+ * Straight from the mapping when the file already holds samples in the
+ * format we hand out (32bit integer or float, 64bit float).
+ */
+size_t WaveSource::borrowSamples(const void **data, size_t nsamples)
+{
+    if (!m_map || m_block_align != int(m_asbd.mBytesPerFrame)) {
+        size_t size = nsamples * m_asbd.mBytesPerFrame;
+        if (m_pivot.size() < size)
+            m_pivot.resize(size);
+        *data = m_pivot.data();
+        return readSamples(m_pivot.data(), nsamples);
+    }
+    nsamples = std::min(static_cast<uint64_t>(nsamples), mappedLeft());
+    *data = mapped(nsamples);
+    m_position += nsamples;
+    return nsamples;
+}
+
 void WaveSource::seekTo(int64_t count)
 {
-    if (m_seekable) {
-        CHECKCRT(lseek(fd(), m_data_pos + count * m_block_align,
-                           SEEK_SET) < 0);
+    if (m_map) {
+        m_position = count;
+        size_t off = m_data - static_cast<uint8_t*>(m_map.get())
+                   + std::min(static_cast<uint64_t>(count), m_mapped)
+                        * m_block_align;
+        m_advised = off - off % MAP_WINDOW;
+    } else if (m_seekable) {
+        m_reader->seek(m_data_pos + count * m_block_align);
         m_position = count;
     }
     else if (m_position > count)
         throw std::runtime_error("Cannot seek back the input");
     else {
-        char buf[0x1000];
         int64_t nread = 0;
         int64_t bytes = (count - m_position) * m_block_align;
+        size_t chunk = std::min(bytes, SKIP_CHUNK);
+        if (m_buffer.size() < chunk)
+            m_buffer.resize(chunk);
         while (nread < bytes) {
-            int n = util::nread(fd(), buf, std::min(bytes - nread, (int64_t)0x1000));
-            if (n < 0) break;
+            ssize_t n = read(m_buffer.data(), std::min(bytes - nread,
+                                                       int64_t(chunk)));
+            if (n <= 0) break;
             nread += n;
         }
         m_position += nread / m_block_align;
     }
 }
 
+/*
+ * Reads from what is left of the head buffer first, then from the file.
+ * For a non-seekable input, the head may well hold the start of PCM data.
+ */
+ssize_t WaveSource::read(void *buffer, size_t size)
+{
+    size_t n = 0;
+    if (m_head_pos < m_head.size()) {
+        n = std::min(size, m_head.size() - m_head_pos);
+        std::memcpy(buffer, &m_head[m_head_pos], n);
+        m_head_pos += n;
+        if (m_head_pos == m_head.size()) {
+            m_head.clear();
+            m_head_pos = 0;
+        }
+    }
+    if (n < size) {
+        char *bp = static_cast<char*>(buffer) + n;
+        ssize_t rc = m_reader ? m_reader->read(bp, size - n)
+                              : util::nread(fd(), bp, size - n);
+        if (rc < 0 && !n)
+            return rc;
+        if (rc > 0)
+            n += rc;
+    }
+    m_offset += n;
+    return n;
+}
+
 int64_t WaveSource::parse()
 {
     int64_t data_length = 0;
@@ -115,7 +248,8 @@ int64_t WaveSource::parse()
 
     while (nextChunk(&size) != FOURCCR('d','a','t','a'))
         skip((size + 1) & ~1);
-    if (fcc != FOURCCR('R','F','6','4'))
+    /* streaming writers put ~0 here, as they can't come back to fix it */
+    if (fcc != FOURCCR('R','F','6','4') && size != 0xffffffff)
         data_length = size;
 
     return data_length;
@@ -123,28 +257,40 @@ int64_t WaveSource::parse()
 
 inline void WaveSource::read16le(void *n)
 {
-    util::check_eof(util::nread(fd(), n, 2) == 2);
+    util::check_eof(read(n, 2) == 2);
 }
 
 inline void WaveSource::read32le(void *n)
 {
-    util::check_eof(util::nread(fd(), n, 4) == 4);
+    util::check_eof(read(n, 4) == 4);
 }
 
 inline void WaveSource::read64le(void *n)
 {
-    util::check_eof(util::nread(fd(), n, 8) == 8);
+    util::check_eof(read(n, 8) == 8);
 }
 
 void WaveSource::skip(int64_t n)
 {
-    if (m_seekable)
-        CHECKCRT(lseek(fd(), n, SEEK_CUR) < 0);
-    else {
-        char buf[8192];
+    if (m_head_pos < m_head.size()) {
+        size_t nn = std::min(static_cast<uint64_t>(n),
+                             static_cast<uint64_t>(m_head.size() - m_head_pos));
+        m_head_pos += nn;
+        m_offset += nn;
+        n -= nn;
+    }
+    if (n <= 0)
+        return;
+    if (m_seekable) {
+        CHECKCRT(lseek(fd(), m_offset + n, SEEK_SET) < 0);
+        m_offset += n;
+        m_head.clear();
+        m_head_pos = 0;
+    } else {
+        std::vector<char> buf(std::min(n, SKIP_CHUNK));
         while (n > 0) {
-            int nn = static_cast<int>(std::min(n, (int64_t)8192));
-            util::check_eof(util::nread(fd(), buf, nn) == nn);
+            int nn = static_cast<int>(std::min(n, SKIP_CHUNK));
+            util::check_eof(read(buf.data(), nn) == nn);
             n -= nn;
         }
     }
@@ -221,7 +367,7 @@ void WaveSource::fmt(size_t size)
         if (dwChannelMask > 0 && util::bitcount(dwChannelMask) >= nChannels)
             m_chanmap = chanmap::getChannels(dwChannelMask, nChannels);
 
-        util::check_eof(util::nread(fd(), &guid, sizeof guid) == sizeof guid);
+        util::check_eof(read(&guid, sizeof guid) == sizeof guid);
         skip((size - 39) & ~1);
 
         if (!std::memcmp(&guid, &wave::ksFormatSubTypeFloat, sizeof guid))
@@ -4,6 +4,7 @@
 #include "ISource.h"
 #include "cautil.h"
 #include "win32util.h"
+#include "AsyncReader.h"
 
 namespace wave {
     struct GUID {
@@ -16,18 +17,37 @@ namespace wave {
     extern const GUID ksFormatSubTypeFloat;
 }
 
-class WaveSource: public ISeekableSource {
+class WaveSource: public ISeekableSource, public IBorrowableSource {
     bool m_seekable;
     int m_block_align;
     int64_t m_data_pos;
     int64_t m_position;
+    int64_t m_offset;
     uint64_t m_length;
     std::shared_ptr<FILE> m_fp;
+    std::shared_ptr<AsyncReader> m_reader; /* PCM data, once parsed */
+    /*
+     * Seekable files are mapped instead, from the page holding the start
+     * of the data chunk. m_data points at the first frame.
+     */
+    std::shared_ptr<void> m_map;
+    size_t m_map_size;
+    size_t m_advised;
+    const uint8_t *m_data;
+    uint64_t m_mapped; /* frames available in the mapping */
+    std::vector<uint8_t> m_pivot;
     std::vector<uint32_t> m_chanmap;
     std::vector<uint8_t> m_buffer;
+    std::vector<uint8_t> m_head;
+    size_t m_head_pos;
     AudioStreamBasicDescription m_asbd;
 public:
-    WaveSource(const std::shared_ptr<FILE> &fp, bool ignorelength = false);
+    /*
+     * head: bytes already read from the current position of fp, if any.
+     * Headers are parsed from there before touching the file again.
+     */
+    WaveSource(const std::shared_ptr<FILE> &fp, bool ignorelength = false,
+               const std::vector<uint8_t> &head = std::vector<uint8_t>());
     uint64_t length() const { return m_length; }
     const AudioStreamBasicDescription &getSampleFormat() const
     {
@@ -39,10 +59,19 @@ public:
     }
     int64_t getPosition() { return m_position; }
     size_t readSamples(void *buffer, size_t nsamples);
+    size_t borrowSamples(const void **data, size_t nsamples);
     bool isSeekable() { return win32::is_seekable(fileno(m_fp.get())); }
     void seekTo(int64_t count);
 private:
     int fd() { return fileno(m_fp.get()); }
+    ssize_t read(void *buffer, size_t size);
+    bool map();
+    const uint8_t *mapped(size_t nsamples);
+    uint64_t mappedLeft() const
+    {
+        uint64_t pos = m_position;
+        return pos < m_mapped ? m_mapped - pos : 0;
+    }
     int64_t parse();
     void read16le(void *n);
     void read32le(void *n);
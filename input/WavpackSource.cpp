@@ -240,7 +240,7 @@ void WavpackSource::fetchTags()
         auto pos = std::find(cover.begin(), cover.end(), '\0');
         std::rotate(cover.begin(), pos + 1, cover.end());
         cover.resize(cover.end() - pos - 1);
-        m_tags["COVER ART"] = std::string(cover.begin(), cover.end());
+        m_artworks.push_back(misc::internBlob(cover.data(), cover.size()));
     }
 }
 
@@ -62,6 +62,7 @@ class WavpackSource: public ISeekableSource, public ITagParser
     std::shared_ptr<FILE> m_fp, m_cfp;
     std::vector<uint32_t> m_chanmap;
     std::map<std::string, std::string> m_tags;
+    std::vector<misc::blob_t> m_artworks;
     std::vector<uint8_t> m_pivot;
     size_t (WavpackSource::*m_readSamples)(void *, size_t);
     AudioStreamBasicDescription m_asbd;
@@ -86,6 +87,10 @@ public:
     bool isSeekable() { return win32::is_seekable(fileno(m_fp.get())); }
     void seekTo(int64_t count);
     const std::map<std::string, std::string> &getTags() const { return m_tags; }
+    const std::vector<misc::blob_t> &getArtworks() const
+    {
+        return m_artworks;
+    }
 private:
     bool parseWrapper();
     void fetchTags();
@@ -10,6 +10,8 @@
 #include <sstream>
 #include <iostream>
 #include <filesystem> // C++17
+#include <thread>
+#include <atomic>
 #include "win32util.h"
 #include "options.h"
 #include "InputFactory.h"
@@ -21,12 +23,12 @@
 #include "CompositeSource.h"
 #include "NullSource.h"
 #include "SoxrResampler.h"
-/*
-#include "SoxLowpassFilter.h"
-*/
+#include "PolyphaseResampler.h"
+#include "LowpassFilter.h"
 /*
 #include "Normalizer.h"
 */
+#include "AnalysisCache.h"
 #include "MatrixMixer.h"
 /*
 #include "Quantizer.h"
@@ -39,8 +41,11 @@
 #include "PipedReader.h"
 */
 #include "TrimmedSource.h"
+#include "TeeSource.h"
+#include "CueSplitter.h"
 #include "chanmap.h"
 #include "ChannelMapper.h"
+#include "FusedFilter.h"
 #include "logging.h"
 /*
 #include "Compressor.h"
@@ -336,24 +341,20 @@ void manipulate_channels(std::vector<std::shared_ptr<ISource> > &chain,
     }
     // remix
     if (opts.remix_preset || opts.remix_file) {
-        if (!SoXConvolverModule::instance().loaded())
-            LOG("WARNING: mixer requires libsoxconvolver. Mixing disabled\n");
-        else {
-            std::vector<std::vector<misc::complex_t> > matrix;
-            if (opts.remix_file)
-                matrix = misc::loadRemixerMatrixFromFile(opts.remix_file);
-            else
-                matrix = misc::loadRemixerMatrixFromPreset(opts.remix_preset);
-            if (opts.verbose > 1 || opts.logfilename) {
-                LOG("Matrix mixer: %uch -> %uch\n",
-                    static_cast<uint32_t>(matrix[0].size()),
-                    static_cast<uint32_t>(matrix.size()));
-            }
-            std::shared_ptr<ISource>
-                mixer(new MatrixMixer(chain.back(),
-                                      matrix, !opts.no_matrix_normalize));
-            chain.push_back(mixer);
+        std::vector<std::vector<misc::complex_t> > matrix;
+        if (opts.remix_file)
+            matrix = misc::loadRemixerMatrixFromFile(opts.remix_file);
+        else
+            matrix = misc::loadRemixerMatrixFromPreset(opts.remix_preset);
+        if (opts.verbose > 1 || opts.logfilename) {
+            LOG("Matrix mixer: %uch -> %uch\n",
+                static_cast<uint32_t>(matrix[0].size()),
+                static_cast<uint32_t>(matrix.size()));
         }
+        std::shared_ptr<ISource>
+            mixer(new MatrixMixer(chain.back(),
+                                  matrix, !opts.no_matrix_normalize));
+        chain.push_back(mixer);
     }
 
     uint32_t nchannels = chain.back()->getSampleFormat().mChannelsPerFrame;
@@ -389,9 +390,52 @@ std::string pcm_format_str(AudioStreamBasicDescription &asbd)
 }
 
 /*
-static double do_normalize(std::vector<std::shared_ptr<ISource> > &chain,
-                           const Options &opts, bool seekable)
+static std::string analysis_tag(
+        const std::vector<std::shared_ptr<ISource> > &chain,
+        const Options &opts)
+{
+    // what the measurement is taken after: the filters and their settings.
+    // Spelled out rather than typeid().name(), which is not stable across
+    // compilers and builds; bump the version when the meaning changes.
+    std::string tag = "v1";
+    for (size_t i = 1; i < chain.size(); ++i) {
+        AudioStreamBasicDescription asbd = chain[i]->getSampleFormat();
+        tag += strutil::format("+%s/%g/%u", pcm_format_str(asbd).c_str(),
+                               asbd.mSampleRate, asbd.mChannelsPerFrame);
+    }
+    tag += strutil::format(":lpf%d:mask%d", opts.lowpass, opts.chanmask);
+    if (opts.remix_preset)
+        tag += strutil::format(":remix=%s", opts.remix_preset);
+    if (opts.remix_file)
+        tag += strutil::format(":remix=%s",
+                     win32::GetFullPathName(opts.remix_file).c_str());
+    for (size_t i = 0; i < opts.chanmap.size(); ++i)
+        tag += strutil::format("%c%u", i ? ',' : ':', opts.chanmap[i]);
+    for (size_t i = 0; i < opts.drc_params.size(); ++i) {
+        const DRCParams &p = opts.drc_params[i];
+        tag += strutil::format(":drc%g/%g/%g/%g/%g", p.m_threshold, p.m_ratio,
+                               p.m_knee_width, p.m_attack, p.m_release);
+    }
+    for (size_t i = 0; i < tag.size(); ++i)
+        if (tag[i] == '\t' || tag[i] == '\n')
+            tag[i] = ' ';
+    return tag;
+}
+
+// returns false when the scale came from the analysis cache
+static bool do_normalize(const std::shared_ptr<ISource> &input,
+                         std::vector<std::shared_ptr<ISource> > &chain,
+                         const Options &opts, bool seekable)
 {
+    std::string tag = analysis_tag(chain, opts);
+    AnalysisCache::Analysis a;
+    if (AnalysisCache::instance().lookup(input, tag, &a)) {
+        LOG("Peak: %g (%gdB), cached\n", a.peak, util::scale_to_dB(a.peak));
+        if (a.peak > FLT_MIN)
+            chain.push_back(std::make_shared<Scaler>(chain.back(),
+                                                     1.0/a.peak));
+        return false;
+    }
     std::shared_ptr<ISource> src = chain.back();
     Normalizer *normalizer = new Normalizer(src, seekable);
     chain.push_back(std::shared_ptr<ISource>(normalizer));
@@ -405,8 +449,15 @@ static double do_normalize(std::vector<std::shared_ptr<ISource> > &chain,
         progress.update(src->getPosition());
     }
     progress.finish(src->getPosition());
-    LOG("Peak: %g (%gdB)\n", normalizer->getPeak(), util::scale_to_dB(normalizer->getPeak()));
-	return normalizer->getPeak();
+    a.peak = normalizer->getPeak();
+    a.true_peak = normalizer->getTruePeak();
+    a.loudness = normalizer->getLoudness();
+    LOG("Peak: %g (%gdB), true peak %gdBTP, loudness %gLUFS\n",
+        a.peak, util::scale_to_dB(a.peak),
+        util::scale_to_dB(a.true_peak), a.loudness);
+    if (!g_interrupted)
+        AnalysisCache::instance().store(input, tag, a);
+    return true;
 }
 */
 
@@ -425,24 +476,42 @@ void build_filter_chain_sub(std::shared_ptr<ISeekableSource> src,
     if (opts.isAAC() || opts.isALAC())
         get_encoding_channel_layout(chain.back().get(), opts, nullptr);
 
-/*
     if (opts.lowpass > 0) {
-        if (!SoXConvolverModule::instance().loaded())
-            LOG("WARNING: --lowpass requires libsoxconvolver. LPF disabled\n");
+        double rate = chain.back()->getSampleFormat().mSampleRate;
+        if (opts.lowpass > LowpassFilter::maxCutoff(rate))
+            LOG("WARNING: --lowpass %dHz is too close to Nyquist, "
+                "LPF disabled\n", opts.lowpass);
         else {
             if (opts.verbose > 1 || opts.logfilename)
                 LOG("Applying LPF: %dHz\n", opts.lowpass);
-            std::shared_ptr<SoxLowpassFilter>
-                f(new SoxLowpassFilter(chain.back(), opts.lowpass));
+            std::shared_ptr<LowpassFilter>
+                f(new LowpassFilter(chain.back(), opts.lowpass,
+                                    threading ? numProcessors : 1));
             chain.push_back(f);
         }
     }
-*/
     {
         double irate = chain.back()->getSampleFormat().mSampleRate;
         double orate = target_sample_rate(opts, chain.back().get());
         if (orate != irate) {
-            throw std::runtime_error("not implemented: change of sample rate");
+            LOG("%gHz -> %gHz\n", irate, orate);
+            if (opts.native_resampler)
+                LOG("WARNING: --native-resampler is not available, "
+                    "using the polyphase SRC\n");
+            /* like libsoxr below: VHQ when float32 is not enough */
+            const AudioStreamBasicDescription &sf
+                = chain.back()->getSampleFormat();
+            bool hires = sf.mBitsPerChannel > 32
+                      || ((sf.mFormatFlags & kAudioFormatFlagIsSignedInteger)
+                          && sf.mBitsPerChannel > 24);
+            std::shared_ptr<PolyphaseResampler>
+                resampler(new PolyphaseResampler(chain.back(), orate,
+                              hires ? PolyphaseResampler::VHQ
+                                    : PolyphaseResampler::HQ,
+                              threading ? numProcessors : 1));
+            if (opts.verbose > 1 || opts.logfilename)
+                LOG("Using polyphase SRC: %u taps\n", resampler->taps());
+            chain.push_back(resampler);
 /*
             if (!opts.native_resampler && SOXRModule::instance().loaded()) {
                 LOG("%gHz -> %gHz\n", irate, orate);
@@ -487,6 +556,7 @@ void build_filter_chain_sub(std::shared_ptr<ISeekableSource> src,
 */
         }
     }
+    /* --drc: needs Compressor.cpp, and WaveSink for the stat file, built */
 /*
     for (size_t i = 0; i < opts.drc_params.size(); ++i) {
         const DRCParams &p = opts.drc_params[i];
@@ -513,8 +583,8 @@ void build_filter_chain_sub(std::shared_ptr<ISeekableSource> src,
 */
 /*
     if (normalize_pass) {
-        do_normalize(chain, opts, src->isSeekable());
-        if (src->isSeekable())
+        if (do_normalize(src, chain, opts, src->isSeekable())
+            && src->isSeekable())
             return;
     }
 */
@@ -587,9 +657,9 @@ void build_filter_chain(std::shared_ptr<ISeekableSource> src,
     chain.push_back(src);
     build_filter_chain_sub(src, chain, opts, opts.normalize);
 /*
-    if (opts.normalize && src->isSeekable()) {
+    Normalizer *normalizer = dynamic_cast<Normalizer*>(chain.back().get());
+    if (opts.normalize && src->isSeekable() && normalizer) {
         src->seekTo(0);
-        Normalizer *normalizer = dynamic_cast<Normalizer*>(chain.back().get());
         double peak = normalizer->getPeak();
         chain.clear();
         chain.push_back(src);
@@ -649,18 +719,16 @@ void set_tags(ISource *src, ISink *sink, const Options &opts,
         const std::map<std::string, std::string> &tags = parser->getTags();
         std::map<std::string, std::string>::const_iterator ssi;
         for (ssi = tags.begin(); ssi != tags.end(); ++ssi) {
-            if (!strcasecmp(ssi->first.c_str(), "cover art")) {
-                if (mp4sink && opts.copy_artwork && !opts.artworks.size()) {
-                    std::vector<char> vec(ssi->second.begin(),
-                                          ssi->second.end());
-                    if (opts.artwork_size)
-                        WICConvertArtwork(vec.data(), vec.size(),
-                                          opts.artwork_size, &vec);
-                    mp4sink->addArtwork(vec);
-                }
-            } else if (accept_tag(ssi->first))
+            if (accept_tag(ssi->first))
                 tagstore->setTag(ssi->first, ssi->second);
         }
+        if (mp4sink && opts.copy_artwork && !opts.artworks.size()) {
+            auto &artworks = parser->getArtworks();
+            for (size_t i = 0; i < artworks.size(); ++i)
+                mp4sink->addArtwork(opts.artwork_size ?
+                    WICConvertArtworkCached(artworks[i], opts.artwork_size)
+                    : artworks[i]);
+        }
         if (mp4sink) {
             IChapterParser *cp = dynamic_cast<IChapterParser*>(src);
             if (cp) {
@@ -731,10 +799,11 @@ void decode_file(const std::vector<std::shared_ptr<ISource> > &chain,
     std::vector<uint8_t> buffer(4096 * bpf);
     try {
         size_t nread;
+        const void *data;
         while (!g_interrupted &&
-               (nread = src->readSamples(&buffer[0], 4096)) > 0) {
+               (nread = borrowSamples(src.get(), &buffer, &data, 4096)) > 0) {
             progress.update(src->getPosition());
-            sink->writeSamples(&buffer[0], nread * bpf, nread);
+            sink->writeSamples(data, nread * bpf, nread);
         }
         progress.finish(src->getPosition());
     } catch (const std::exception &e) {
@@ -766,6 +835,9 @@ uint32_t map_to_aac_channels(std::vector<std::shared_ptr<ISource> > &chain,
     std::shared_ptr<ISource>
         mapper(new ChannelMapper(chain.back(), map, 0, tag));
     chain.push_back(mapper);
+    /* the mapper is the last per-sample stage, so fuse only now */
+    if (FusedFilter::optimize(chain) && (opts.verbose > 1 || opts.logfilename))
+        LOG("Fused per-sample filters into a single pass\n");
 
     if (opts.verbose > 1) {
         AudioChannelLayout acl = { 0 };
@@ -808,12 +880,12 @@ void do_encode(IEncoder *encoder, const std::string &ofilename,
     }
 }
 
-/*
-static void do_optimize(MP4FileX *file, const std::string &dst, bool verbose)
+static void do_optimize(MP4FileX *file, FILE *src, const std::string &dst,
+                        bool verbose)
 {
     try {
         file->FinishWriteX();
-        MP4FileCopy optimizer(file);
+        MP4FileCopy optimizer(file, src);
         optimizer.start((dst).c_str());
         uint64_t total = optimizer.getTotalChunks();
         PeriodicDisplay disp(100, verbose);
@@ -828,7 +900,6 @@ static void do_optimize(MP4FileX *file, const std::string &dst, bool verbose)
         handle_mp4error(e);
     }
 }
-*/
 
 static
 void finalize_m4a(MP4SinkBase *sink, IEncoder *encoder,
@@ -848,9 +919,11 @@ void finalize_m4a(MP4SinkBase *sink, IEncoder *encoder,
     }
     sink->writeTags();
     sink->writeBitrates(stat->overallBitrate() * 1000.0 + .5);
-    if (!opts.no_optimize)
-        do_optimize(sink->getFile(), ofilename, opts.verbose);
 */
+    /* the sink wrote to a temporary file, unless --no-optimize */
+    if (!opts.no_optimize)
+        do_optimize(sink->getFile(), sink->getFilePtr(), ofilename,
+                    opts.verbose);
     sink->close();
 }
 
@@ -966,18 +1039,10 @@ FARPROC WINAPI DllImportHook(unsigned notify, PDelayLoadInfo pdli)
 */
 
 static
-void encode_file(const std::shared_ptr<ISeekableSource> &src,
-                 const std::string &ofilename, const Options &opts)
+void encode_chain(const std::shared_ptr<ISeekableSource> &src,
+                  std::vector<std::shared_ptr<ISource> > &chain,
+                  const std::string &ofilename, const Options &opts)
 {
-    std::vector<std::shared_ptr<ISource> > chain;
-    build_filter_chain(src, chain, opts);
-
-/*
-    if (opts.isLPCM() || opts.isWaveOut() || opts.isPeak()) {
-        decode_file(chain, ofilename, opts);
-        return;
-    }
-*/
     uint32_t channel_layout = map_to_aac_channels(chain, opts);
     AudioStreamBasicDescription iasbd = chain.back()->getSampleFormat();
     AudioStreamBasicDescription oasbd =
@@ -1048,6 +1113,61 @@ void encode_file(const std::shared_ptr<ISeekableSource> &src,
         cafsink->finishWrite(pti);
 */
 }
+
+static
+void encode_file(const std::shared_ptr<ISeekableSource> &src,
+                 const std::string &ofilename, const Options &opts)
+{
+    std::vector<std::shared_ptr<ISource> > chain;
+    build_filter_chain(src, chain, opts);
+
+/*
+    if (opts.isLPCM() || opts.isWaveOut() || opts.isPeak()) {
+        decode_file(chain, ofilename, opts);
+        return;
+    }
+*/
+    encode_chain(src, chain, ofilename, opts);
+}
+
+/*
+ * --tee: decode once into a TeeSource, then run one encoder per output on
+ * its own thread. Only decoding is shared: each branch builds its whole
+ * filter chain with build_filter_chain_sub() from its own options.
+ */
+static
+void encode_file_tee(const std::shared_ptr<ISeekableSource> &src,
+                     const std::vector<std::string> &ofilenames,
+                     const std::vector<Options> &outputs)
+{
+    size_t n = outputs.size();
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(n);
+    {
+        /* --rate, --lowpass, --bits etc. can differ between outputs */
+        auto tee = std::make_shared<TeeSource>(src, n);
+        std::vector<std::vector<std::shared_ptr<ISource> > > chains(n);
+        for (size_t i = 0; i < n; ++i) {
+            chains[i].push_back(tee->branch(i));
+            build_filter_chain_sub(src, chains[i], outputs[i]);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            threads.emplace_back([&, i] {
+                try {
+                    encode_chain(src, chains[i], ofilenames[i], outputs[i]);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+                chains[i].clear();
+            });
+        }
+        for (size_t i = 0; i < n; ++i)
+            threads[i].join();
+    }
+    for (size_t i = 0; i < n; ++i)
+        if (errors[i])
+            std::rethrow_exception(errors[i]);
+}
 #endif // QAAC
 #ifdef REFALAC
 
@@ -1182,7 +1302,19 @@ void load_cue_tracks(const Options &opts, std::streambuf *sb, bool is_embedded,
 {
     CueSheet cue;
     cue.parse(sb);
-    auto tracks = cue.loadTracks(is_embedded, path, opts.cue_tracks);
+    bool parallel = opts.cue_jobs > 1;
+    auto tracks = cue.loadTracks(is_embedded, path, opts.cue_tracks,
+                                 parallel && !opts.cue_single_decoder);
+    bool seekable = std::all_of(tracks.begin(), tracks.end(),
+                                [](const std::shared_ptr<ISeekableSource> &t) {
+                                    return t->isSeekable();
+                                });
+    if (parallel && tracks.size() > 1 &&
+        (opts.cue_single_decoder || !seekable)) {
+        auto splitter = std::make_shared<CueSplitter>(tracks);
+        for (size_t i = 0; i < tracks.size(); ++i)
+            tracks[i] = splitter->track(i);
+    }
     for (size_t i = 0; i < tracks.size(); ++i) {
         auto parser = dynamic_cast<ITagParser*>(tracks[i].get());
         const char *spec = opts.fname_format;
@@ -1194,12 +1326,17 @@ void load_cue_tracks(const Options &opts, std::streambuf *sb, bool is_embedded,
 }
 */
 
+static bool is_cue_file(const fs::path &path)
+{
+    return strcasecmp(path.extension().string().c_str(), ".cue") == 0;
+}
+
 static
 void load_track(const char *ifilename, const Options &opts,
                 std::vector<workItem> &tracks)
 {
     fs::path filepath(ifilename);
-    if (filepath.extension() == ".cue") {
+    if (is_cue_file(filepath)) {
         throw std::runtime_error("not implemented: cue");
 /*
         auto basename = filepath.filename();
@@ -1224,6 +1361,8 @@ void load_track(const char *ifilename, const Options &opts,
 
     std::string ofilename(ifilename);
     auto src = InputFactory::instance().open(ifilename);
+    if (opts.normalize)
+        AnalysisCache::instance().setIdentity(src, ifilename);
 /*
     auto parser = dynamic_cast<ITagParser*>(src.get());
     if (parser) {
@@ -1277,10 +1416,10 @@ void load_metadata_files(Options *opts)
             auto type = mp4v2::impl::itmf::computeBasicType(data, size);
             if (type == mp4v2::impl::itmf::BT_IMPLICIT)
                 throw std::runtime_error("Unknown artwork image type");
-            std::vector<char> vec(data, data + size);
+            auto blob = misc::internBlob(data, size);
             if (opts->artwork_size)
-                WICConvertArtwork(data, size, opts->artwork_size, &vec);
-            opts->artworks.push_back(vec);
+                blob = WICConvertArtworkCached(blob, opts->artwork_size);
+            opts->artworks.push_back(blob);
         } catch (const std::exception &e) {
             LOG("WARNING: %s\n", errormsg(e).c_str());
         }
@@ -1311,6 +1450,81 @@ std::string get_output_filename(const std::string &ifilename,
     return outputPath.string();
 }
 
+static
+void encode_work_item(const workItem &item, const std::string &ofilename,
+                      const Options &opts, const std::vector<Options> &tees)
+{
+    // dont trim
+    //auto src = trim_input(item.second, opts);
+    auto src = item.second;
+
+    src->seekTo(0);
+    if (!tees.size()) {
+        encode_file(src, ofilename, opts);
+        return;
+    }
+    std::vector<Options> outputs(1, opts);
+    std::vector<std::string> ofilenames(1, ofilename);
+    for (size_t j = 0; j < tees.size(); ++j) {
+        std::string name = get_output_filename(item.first, tees[j]);
+        if (std::find(ofilenames.begin(), ofilenames.end(), name)
+                != ofilenames.end())
+            throw std::runtime_error("--tee: output filename collides: "
+                                     + name);
+        LOG("%s\n", name == "-" ? "<stdout>" : name.c_str());
+        ofilenames.push_back(name);
+        outputs.push_back(tees[j]);
+    }
+    encode_file_tee(src, ofilenames, outputs);
+}
+
+/*
+ * --cue-jobs: encode the tracks [begin, end) of one input on a pool of
+ * threads. Each track either has decoders of its own, or is fed by a
+ * CueSplitter. Tracks are claimed in order, so the splitter never has to
+ * decode more than cue_jobs tracks ahead of the slowest encoder.
+ * A track is released as soon as it is done, closing its decoder.
+ */
+static
+void encode_work_items_parallel(std::vector<workItem> &items,
+                                size_t begin, size_t end,
+                                const Options &opts,
+                                const std::vector<Options> &tees)
+{
+    std::vector<std::string> ofilenames;
+    for (size_t i = begin; i < end; ++i) {
+        ofilenames.push_back(get_output_filename(items[i].first, opts));
+        LOG("\n%s\n", ofilenames.back() == "-" ? "<stdout>"
+                                                : ofilenames.back().c_str());
+    }
+    /* progress lines of concurrent encoders would just garble each other */
+    Options popts(opts);
+    popts.verbose = std::min(popts.verbose, 0);
+
+    std::atomic<size_t> next(begin);
+    std::vector<std::exception_ptr> errors(end - begin);
+    std::vector<std::thread> threads;
+    size_t njobs = std::min(static_cast<size_t>(opts.cue_jobs), end - begin);
+    for (size_t k = 0; k < njobs; ++k) {
+        threads.emplace_back([&] {
+            for (size_t i; (i = next++) < end && !g_interrupted; ) {
+                try {
+                    encode_work_item(items[i], ofilenames[i - begin],
+                                     popts, tees);
+                } catch (...) {
+                    errors[i - begin] = std::current_exception();
+                }
+                items[i].second.reset();
+            }
+        });
+    }
+    for (size_t k = 0; k < threads.size(); ++k)
+        threads[k].join();
+    for (size_t i = 0; i < errors.size(); ++i)
+        if (errors[i])
+            std::rethrow_exception(errors[i]);
+}
+
 
 // based on loadlibrary/mpclient.c
 // Any usage limits to prevent bugs disrupting system.
@@ -1660,11 +1874,9 @@ FIXME
 /*
         load_metadata_files(&opts);
 */
-        if (opts.tmpdir) {
-            std::string env("TMP=");
-            env += opts.tmpdir;
-            putenv((char*) env.c_str());
-        }
+        if (opts.tmpdir)
+            setenv("TMP", opts.tmpdir, 1);
+        win32::set_tmpfile_memory_limit(uint64_t(opts.tmp_memory) << 20);
 
         if (opts.ofilename) {
             std::string fullpath = win32::GetFullPathNameX(opts.ofilename);
@@ -1685,6 +1897,13 @@ FIXME
             InputFactory::instance().setRawFormat(getRawFormat(opts));
         }
         InputFactory::instance().setIgnoreLength(opts.ignore_length);
+        InputFactory::instance().setSpoolInput(opts.spool_input);
+        InputFactory::instance().setCacheLimits(
+                opts.input_cache_files,
+                uint64_t(opts.input_cache_size) << 20);
+        if (opts.threading)
+            InputFactory::instance().setDecodeThreads(
+                    std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L));
 
         struct CleanupScope {
             ~CleanupScope() {
@@ -1693,40 +1912,64 @@ FIXME
         } __cleanup__;
 
         std::vector<workItem> workItems;
-        for (int i = 0; i < argc; ++i)
+        /* index of the first track of each input */
+        std::vector<size_t> inputs;
+        /*
+         * With --concat, plain inputs are added to the composite by path
+         * and opened only shortly before they play.
+         */
+        for (int i = 0; i < argc && !opts.concat; ++i) {
+            inputs.push_back(workItems.size());
             load_track(argv[i], opts, workItems);
+        }
+        inputs.push_back(workItems.size());
+
+        std::vector<Options> tees;
+        for (size_t i = 0; i < opts.tee_specs.size(); ++i) {
+            Options topts(opts);
+            if (!topts.parseTee(opts.tee_specs[i]))
+                return 1;
+            /* progress is shown for the main output only */
+            topts.verbose = std::min(topts.verbose, 0);
+            tees.push_back(topts);
+        }
 
         if (!opts.concat) {
-            for (size_t i = 0; i < workItems.size() && !g_interrupted; ++i) {
+            for (size_t k = 0, i = 0; i < workItems.size() && !g_interrupted;
+                 ++i) {
+                while (inputs[k + 1] <= i)
+                    ++k;
+                if (opts.cue_jobs > 1 && inputs[k + 1] - i > 1) {
+                    encode_work_items_parallel(workItems, i, inputs[k + 1],
+                                               opts, tees);
+                    i = inputs[k + 1] - 1;
+                    continue;
+                }
                 std::string ofilename =
                     get_output_filename(workItems[i].first, opts);
                 LOG("\n%s\n",
                     ofilename == "-" ? "<stdout>"
                                       : ofilename.c_str());
-
-                // dont trim
-                //auto src = trim_input(workItems[i].second, opts);
-                auto src = workItems[i].second;
-
-                src->seekTo(0);
-                encode_file(src, ofilename, opts);
+                encode_work_item(workItems[i], ofilename, opts, tees);
             }
         } else {
-            throw std::runtime_error("not implemented: concat");
-            /*
             std::string ofilename = get_output_filename(argv[0], opts);
             LOG("\n%s\n",
                 ofilename == "-" ? "<stdout>"
                                   : ofilename.c_str());
 
             auto cs = std::make_shared<CompositeSource>();
-            for (size_t i = 0; i < workItems.size(); ++i)
-                cs->addSourceWithChapter(workItems[i].second, "");
-
-            auto src = trim_input(cs, opts);
-            src->seekTo(0);
-            encode_file(src, ofilename, opts);
-            */
+            for (int i = 0; i < argc; ++i) {
+                if (!is_cue_file(argv[i])) {
+                    cs->addSourceWithChapter(argv[i], "");
+                    continue;
+                }
+                std::vector<workItem> tracks;
+                load_track(argv[i], opts, tracks);
+                for (size_t j = 0; j < tracks.size(); ++j)
+                    cs->addSourceWithChapter(tracks[j].second, "");
+            }
+            encode_work_item(workItem(argv[0], cs), ofilename, opts, tees);
         }
     } catch (const std::exception &e) {
         LOG("ERROR: %s\n", errormsg(e).c_str());
@@ -9,6 +9,8 @@
 #pragma warning(pop)
 #include <uchardet/uchardet.h>
 #include <regex>
+#include <mutex>
+#include <unordered_map>
 
 namespace misc
 {
@@ -308,4 +310,51 @@ namespace misc
         return loadRemixerMatrix(openConfigFile(path.c_str()));
     }
 
+    uint64_t hashBlob(const void *data, size_t size)
+    {
+        /* FNV-1a */
+        const uint8_t *p = static_cast<const uint8_t*>(data);
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < size; ++i)
+            h = (h ^ p[i]) * 0x100000001b3ULL;
+        return h;
+    }
+
+    blob_t internBlob(const void *data, size_t size)
+    {
+        static std::mutex mutex;
+        static std::unordered_multimap<uint64_t,
+                                       std::weak_ptr<const std::vector<char>>>
+            blobs;
+
+        uint64_t h = hashBlob(data, size);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto range = blobs.equal_range(h);
+        for (auto it = range.first; it != range.second; ) {
+            blob_t blob = it->second.lock();
+            if (!blob) {
+                it = blobs.erase(it);
+                continue;
+            }
+            if (blob->size() == size &&
+                std::equal(blob->begin(), blob->end(),
+                           static_cast<const char*>(data)))
+                return blob;
+            ++it;
+        }
+        const char *p = static_cast<const char*>(data);
+        blob_t blob = std::make_shared<const std::vector<char>>(p, p + size);
+        blobs.insert(std::make_pair(h, blob));
+        return blob;
+    }
+
+    void moveArtwork(std::map<std::string, std::string> *tags,
+                     std::vector<blob_t> *artworks)
+    {
+        auto it = tags->find("COVER ART");
+        if (it == tags->end())
+            return;
+        artworks->push_back(internBlob(it->second.data(), it->second.size()));
+        tags->erase(it);
+    }
 }
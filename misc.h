@@ -12,6 +12,8 @@
 namespace misc {
     typedef std::pair<std::string, double> chapter_t;
     typedef std::complex<float> complex_t;
+    /* immutable bytes shared by reference, such as cover art */
+    typedef std::shared_ptr<const std::vector<char> > blob_t;
 
     std::string loadTextFile(const std::string &path, int codepage=0);
 
@@ -34,6 +36,19 @@ namespace misc {
 
     std::vector<std::vector<complex_t>>
     loadRemixerMatrixFromPreset(const char *preset_name);
+
+    uint64_t hashBlob(const void *data, size_t size);
+
+    /*
+     * Returns the copy of these bytes that is already alive somewhere in
+     * the process, or makes one. An album's worth of tracks thereby
+     * shares a single copy of the same picture.
+     */
+    blob_t internBlob(const void *data, size_t size);
+
+    /* moves "COVER ART" of a fetched tag map over to artworks */
+    void moveArtwork(std::map<std::string, std::string> *tags,
+                     std::vector<blob_t> *artworks);
 }
 
 #endif
@@ -1656,6 +1656,18 @@ void MP4Track::RewriteChunk(MP4ChunkId chunkId,
                   m_trackId, chunkId, chunkOffset, chunkSize, chunkSize);
 }
 
+uint64_t MP4Track::GetChunkOffset(MP4ChunkId chunkId)
+{
+    ASSERT(chunkId);
+    return m_pChunkOffsetProperty->GetValue(chunkId - 1);
+}
+
+void MP4Track::SetChunkOffset(MP4ChunkId chunkId, uint64_t chunkOffset)
+{
+    ASSERT(chunkId);
+    m_pChunkOffsetProperty->SetValue(chunkOffset, chunkId - 1);
+}
+
 // map track type name aliases to official names
 
 
@@ -166,6 +166,12 @@ public:
     void RewriteChunk(MP4ChunkId chunkId,
                       uint8_t* pChunk, uint32_t chunkSize);
 
+    uint32_t GetChunkSize(MP4ChunkId chunkId);
+
+    uint64_t GetChunkOffset(MP4ChunkId chunkId);
+
+    void SetChunkOffset(MP4ChunkId chunkId, uint64_t chunkOffset);
+
     MP4Duration GetDurationPerChunk();
     void        SetDurationPerChunk( MP4Duration );
 
@@ -176,7 +182,6 @@ protected:
     uint64_t    GetSampleFileOffset(MP4SampleId sampleId);
     uint32_t    GetSampleStscIndex(MP4SampleId sampleId);
     uint32_t    GetChunkStscIndex(MP4ChunkId chunkId);
-    uint32_t    GetChunkSize(MP4ChunkId chunkId);
     uint32_t    GetSampleCttsIndex(MP4SampleId sampleId,
                                    MP4SampleId* pFirstSampleId = NULL);
     MP4SampleId GetNextSyncSample(MP4SampleId sampleId);
@@ -353,12 +353,14 @@ bool MP4FileX::SetMetadataFreeForm(const char *name, const char *mean,
     return true;
 }
 
-MP4FileCopy::MP4FileCopy(MP4File *file)
+MP4FileCopy::MP4FileCopy(MP4File *file, FILE *src)
         : m_mp4file(reinterpret_cast<MP4FileX*>(file)),
+          m_srcfp(src),
+          m_next_extent(0),
+          m_pipe_out(false),
           m_src(reinterpret_cast<MP4FileX*>(file)->m_file),
           m_dst(0)
 {
-    m_nchunks = 0;
     size_t numTracks = file->GetNumberOfTracks();
     for (size_t i = 0; i < numTracks; ++i) {
         ChunkInfo ci;
@@ -366,7 +368,6 @@ MP4FileCopy::MP4FileCopy(MP4File *file)
         ci.final = m_mp4file->m_pTracks[i]->GetNumberOfChunks();
         ci.time = MP4_INVALID_TIMESTAMP;
         m_state.push_back(ci);
-        m_nchunks += ci.final;
     }
 }
 
@@ -374,7 +375,16 @@ void MP4FileCopy::start(const char *path)
 {
     m_mp4file->m_file = 0;
     try {
-        m_fp = std::shared_ptr<FILE>(win32::wfopenx(strutil::us2w(path).c_str(), "wb"), fclose);
+        /*
+         * Non seekable stdout: finish the file in a temporary spool,
+         * then stream it out in finish().
+         */
+        m_pipe_out = !std::strcmp(path, "-")
+                  && !win32::is_seekable(fileno(stdout));
+        if (m_pipe_out)
+            m_fp = win32::tmpfile("qaac.out");
+        else
+            m_fp = win32::fopen(path, "wb");
         static MP4StdIOCallbacks callbacks;
         m_mp4file->Open(path, File::MODE_CREATE, nullptr, &callbacks, m_fp.get());
     } catch (...) {
@@ -385,6 +395,36 @@ void MP4FileCopy::start(const char *path)
     m_mp4file->SetIntegerProperty("moov.mvhd.modificationTime",
         mp4v2::impl::MP4GetAbsTimestamp());
     dynamic_cast<MP4RootAtom*>(m_mp4file->m_pRootAtom)->BeginOptimalWrite();
+
+    /*
+     * Lay out chunks in the same time-interleaved order as before, assign
+     * their final offsets now, and merge runs which are contiguous in the
+     * source into single extents.
+     * Extents are capped so that progress can still be reported.
+     */
+    const uint64_t max_extent = 0x4000000;
+    uint64_t pos = m_mp4file->GetPosition();
+    for (size_t i; (i = nextTrack()) != ~size_t(0); ) {
+        MP4Track *track = m_mp4file->m_pTracks[i];
+        mp4v2::impl::MP4ChunkId id = m_state[i].current;
+        uint64_t off = track->GetChunkOffset(id);
+        uint32_t size = track->GetChunkSize(id);
+        track->SetChunkOffset(id, pos);
+        if (m_extents.size() &&
+            m_extents.back().src + m_extents.back().size == off &&
+            m_extents.back().size + size <= max_extent)
+            m_extents.back().size += size;
+        else if (size) {
+            Extent e = { off, pos, size };
+            m_extents.push_back(e);
+        }
+        pos += size;
+        m_state[i].current++;
+        m_state[i].time = MP4_INVALID_TIMESTAMP;
+    }
+    /* flush what stdio still holds, we go behind its back from now on */
+    if (std::fflush(m_srcfp) || std::fflush(m_fp.get()))
+        util::throw_crt_error("fflush()");
 }
 
 void MP4FileCopy::finish()
@@ -405,11 +445,17 @@ void MP4FileCopy::finish()
     delete m_dst;
     m_dst = 0;
     m_mp4file->m_file = 0;
+    if (m_pipe_out) {
+        int fd = fileno(m_fp.get());
+        CHECKCRT(std::fflush(m_fp.get()));
+        win32::copy_file_range(fd, 0, fileno(stdout), -1,
+                               win32::filelengthi64(fd));
+    }
 }
 
-bool MP4FileCopy::copyNextChunk()
+size_t MP4FileCopy::nextTrack()
 {
-    uint32_t nextTrack = 0xffffffff;
+    size_t nextTrack = ~size_t(0);
     MP4Timestamp nextTime = MP4_INVALID_TIMESTAMP;
     size_t numTracks = m_mp4file->GetNumberOfTracks();
     for (size_t i = 0; i < numTracks; ++i) {
@@ -429,17 +475,18 @@ bool MP4FileCopy::copyNextChunk()
         nextTime = m_state[i].time;
         nextTrack = i;
     }
-    if (nextTrack == 0xffffffff) return false;
-    MP4Track *track = m_mp4file->m_pTracks[nextTrack];
-    m_mp4file->m_file = m_src;
-    uint8_t *chunk;
-    uint32_t size;
-    track->ReadChunk(m_state[nextTrack].current, &chunk, &size);
-    m_mp4file->m_file = m_dst;
-    track->RewriteChunk(m_state[nextTrack].current, chunk, size);
-    MP4Free(chunk);
-    m_state[nextTrack].current++;
-    m_state[nextTrack].time = MP4_INVALID_TIMESTAMP;
+    return nextTrack;
+}
+
+bool MP4FileCopy::copyNextChunk()
+{
+    if (m_next_extent >= m_extents.size())
+        return false;
+    const Extent &e = m_extents[m_next_extent++];
+    win32::copy_file_range(fileno(m_srcfp), e.src, fileno(m_fp.get()), e.dst,
+                           e.size);
+    /* keep stdio and mp4v2 positions in sync with what was written */
+    m_mp4file->SetPosition(e.dst + e.size);
     return true;
 }
  
@@ -9,6 +9,7 @@
 #undef FindAtom
 #include "src/impl.h"
 #include "util.h"
+#include "win32util.h"
 #include "misc.h"
 
 std::string format_mp4error(const mp4v2::impl::Exception &e);
@@ -79,24 +80,39 @@ protected:
             mp4v2::impl::itmf::BasicType typeCode);
 };
 
+/*
+ * Rewrites the file in fast-start (moov first) layout.
+ * The final chunk layout is planned up front in start(), so that only the
+ * stco/co64 offsets in moov are touched, and mdat payload is moved between
+ * the descriptors in coalesced extents by win32::copy_file_range().
+ */
 class MP4FileCopy {
     struct ChunkInfo {
         mp4v2::impl::MP4ChunkId current, final;
         MP4Timestamp time;
     };
+    struct Extent {
+        uint64_t src, dst, size;
+    };
     MP4FileX *m_mp4file;
     std::shared_ptr<FILE> m_fp;
-    uint64_t m_nchunks;
+    FILE *m_srcfp;
     std::vector<ChunkInfo> m_state;
+    std::vector<Extent> m_extents;
+    size_t m_next_extent;
+    bool m_pipe_out;
     mp4v2::platform::io::File *m_src;
     mp4v2::platform::io::File *m_dst;
 public:
-    MP4FileCopy(mp4v2::impl::MP4File *file);
+    MP4FileCopy(mp4v2::impl::MP4File *file, FILE *src);
     ~MP4FileCopy() { if (m_dst) finish(); }
     void start(const char *path);
     void finish();
     bool copyNextChunk();
-    uint64_t getTotalChunks() { return m_nchunks; }
+    /* number of copyNextChunk() steps, valid after start() */
+    uint64_t getTotalChunks() { return m_extents.size(); }
+private:
+    size_t nextTrack();
 };
 
 struct MP4StdIOCallbacks: public MP4IOCallbacks
@@ -134,6 +150,7 @@ struct MP4StdIOCallbacks: public MP4IOCallbacks
     static int write(void *handle, const void *buffer, int64_t size, int64_t *nout)
     {
         FILE *fp = static_cast<FILE*>(handle);
+        win32::tmpfile_reserve(fileno(fp), ftello(fp) + size);
         *nout = fwrite(buffer, 1, size, fp);
         return ferror(fp);
     }
@@ -59,6 +59,10 @@ static option long_options[] = {
     { "nice", no_argument, 0, 'n' },
     { "sort-args", no_argument, 0, 'soar' },
     { "tmpdir", required_argument, 0, 'tmpd' },
+    { "tmp-memory", required_argument, 0, 'tmpm' },
+    { "tee", required_argument, 0, 'tee ' },
+    { "input-cache", required_argument, 0, 'incc' },
+    { "spool-input", no_argument, 0, 'spin' },
     { "text-codepage", required_argument, 0, 'txcp' },
     { "raw", no_argument, 0, 'R' },
     { "raw-channels", required_argument, 0,  'Rchn' },
@@ -67,6 +71,8 @@ static option long_options[] = {
     { "ignorelength", no_argument, 0, 'i' },
     { "concat", no_argument, 0, 'cat ' },
     { "cue-tracks", required_argument, 0, 'ctrk' },
+    { "cue-jobs", required_argument, 0, 'cjob' },
+    { "cue-single-decoder", no_argument, 0, 'csdc' },
     { "fname-from-tag", no_argument, 0, 'fftg' },
     { "fname-format", required_argument, 0, 'nfmt' },
     { "log", required_argument, 0, 'log ' },
@@ -125,9 +131,7 @@ void usage()
 "Usage: " PROGNAME " [options] infiles....\n"
 "\n"
 "\"-\" as infile means stdin.\n"
-#ifndef REFALAC
-"On ADTS/WAV output mode, \"-\" as outfile means stdout.\n"
-#endif
+"\"-\" as outfile means stdout. MP4 is written out at once when finished.\n"
 "\n"
 "Main options:\n"
 #ifdef QAAC
@@ -239,11 +243,30 @@ void usage()
 "                       When 0 is given, qaac works as if no channel mask is\n"
 "                       present in the source and picks default layout.\n"
 "--no-optimize          Don't optimize MP4 container after encoding.\n"
+"--tee <options>        Also encode the same decoded input to another output.\n"
+"                       <options> selects codec, mode and output for it.\n"
+"                       Other options are taken from the main command line.\n"
+"                       Can be given multiple times. Outputs are encoded in\n"
+"                       parallel, input is read and decoded only once.\n"
+"                       Example:\n"
+"                         --tee \"--he -v 64 -o low.m4a\"\n"
 "--tmpdir <dirname>     Specify temporary directory. Default is %TMP%\n"
+"--tmp-memory <MiB>     Keep temporary files in memory up to this total size\n"
+"                       before spilling them to tmpdir. Default is 256.\n"
+"                       0 means always use tmpdir.\n"
+"--input-cache <n[:MiB]>\n"
+"                       Keep at most <n> input decoders open, holding at\n"
+"                       most <MiB> of memory. Default is 16:256.\n"
+"                       Inputs closed on the way are reopened when needed.\n"
+"--spool-input          Copy pipe input (such as stdin) to a temporary file\n"
+"                       while reading (see --tmp-memory), so that it can be\n"
+"                       seeked back like a regular file.\n"
 "-s, --silent           Suppress console messages.\n"
 "--verbose              More verbose console messages.\n"
 "-i, --ignorelength     Assume WAV input and ignore the data chunk length.\n"
 "--threading            Enable multi-threading.\n"
+"                       Seekable FLAC input is also decoded on several\n"
+"                       threads.\n"
 "-n, --nice             Give lower process priority.\n"
 "--sort-args            Sort filenames given by command line arguments.\n"
 "--text-codepage <n>    Specify text code page of cuesheet/chapter/lyrics.\n"
@@ -277,6 +300,16 @@ void usage()
 "                           -> equivalent to --cue-tracks 1,2,3,6,7,8,9,11\n"
 "                         --cue-tracks 2-99\n"
 "                           -> can be used to skip first track (and HTOA)\n"
+/* --cue-jobs, --cue-single-decoder: hidden until cuesheet input works
+"--cue-jobs <n>         Encode up to <n> tracks concurrently.\n"
+"                       When the image is seekable, each track is read by a\n"
+"                       decoder of its own. Otherwise the image is decoded\n"
+"                       only once, and decoded tracks are spooled to\n"
+"                       temporary files (see --tmp-memory) until their\n"
+"                       encoder catches up.\n"
+"--cue-single-decoder   With --cue-jobs, always decode the image only once,\n"
+"                       even when it is seekable.\n"
+*/
 "\n"
 "Options for Raw PCM input only:\n"
 "-R, --raw              Raw PCM input.\n"
@@ -290,6 +323,7 @@ void usage()
 "                       Last part can be omitted, L is assumed by default.\n"
 "                       Cases are ignored. u16b is OK.\n"
 "\n"
+/* --native-resampler: hidden, the CoreAudio SRC is not available
 #ifdef QAAC
 "Options for CoreAudio sample rate converter:\n"
 "--native-resampler[=line|norm|bats,n]\n"
@@ -306,6 +340,7 @@ void usage()
 "                         --native-resampler=norm,96\n"
 "\n"
 #endif
+*/
 "Tagging options:\n"
 " (same value is set to all files, so use with care for multiple files)\n"
 "--title <string>\n"
@@ -477,10 +512,33 @@ bool Options::parse(int &argc, char **&argv)
             this->no_optimize = true;
         else if (ch == 'cat ')
             this->concat = true;
+        else if (ch == 'csdc') {
+            complain("--cue-single-decoder is not available: "
+                     "cuesheet input is not implemented.\n");
+            return false;
+        }
+        else if (ch == 'spin')
+            this->spool_input = true;
         else if (ch == 'nfmt')
             this->fname_format = optarg;
         else if (ch == 'tmpd')
             this->tmpdir = optarg;
+        else if (ch == 'tee ')
+            this->tee_specs.push_back(optarg);
+        else if (ch == 'incc') {
+            int n = std::sscanf(optarg, "%u:%u", &this->input_cache_files,
+                                &this->input_cache_size);
+            if (n < 1 || !this->input_cache_files) {
+                complain("Invalid arg for --input-cache.\n");
+                return false;
+            }
+        }
+        else if (ch == 'tmpm') {
+            if (std::sscanf(optarg, "%u", &this->tmp_memory) != 1) {
+                complain("--tmp-memory requires an integer.\n");
+                return false;
+            }
+        }
         else if (ch == 'nmxn')
             this->no_matrix_normalize = true;
         else if (ch == 'cmap') {
@@ -660,6 +718,18 @@ bool Options::parse(int &argc, char **&argv)
                 return false;
             }
         }
+        else if (ch == 'cjob') {
+            complain("--cue-jobs is not available: "
+                     "cuesheet input is not implemented.\n");
+            return false;
+/*
+            if (std::sscanf(optarg, "%u", &this->cue_jobs) != 1 ||
+                !this->cue_jobs) {
+                complain("--cue-jobs requires a positive integer.\n");
+                return false;
+            }
+*/
+        }
         else if (ch == 'atsz') {
             if (std::sscanf(optarg, "%u", &this->artwork_size) != 1) {
                 complain("--artwork-size requires an integer.\n");
@@ -768,12 +838,6 @@ bool Options::parse(int &argc, char **&argv)
         this->method = isSBR() ? kCVBR : kTVBR;
         this->bitrate = isSBR() ? 0 : 90;
     }
-    if (isMP4() && this->ofilename && !std::strcmp(this->ofilename, "-")) {
-        if (!is_seekable(fileno(stdout))) {
-            complain("MP4 piping is not supported.\n");
-            return false;
-        }
-    }
     if (!isAAC() && this->is_adts) {
         complain("--adts is only available for AAC.\n");
         return false;
@@ -807,3 +871,44 @@ bool Options::parse(int &argc, char **&argv)
         this->quality = 2;
     return true;
 }
+
+bool Options::parseTee(const std::string &spec)
+{
+    /* start over on codec and output, keep everything else */
+    this->method = -1;
+    this->quality = -1;
+    this->bitrate = -1.0;
+    this->output_format = 0;
+    this->ofilename = 0;
+    this->is_adts = false;
+    this->is_caf = false;
+    this->no_smart_padding = false;
+    this->num_priming = 2112;
+    this->bits_per_sample = 0;
+    this->tee_specs.clear();
+
+    tee_args = std::make_shared<std::vector<char> >(spec.begin(), spec.end());
+    tee_args->push_back(0);
+    std::vector<char *> args;
+    args.push_back(const_cast<char*>(PROGNAME));
+    char *tok, *rest = tee_args->data();
+    while ((tok = strsep(&rest, " \t")) != 0)
+        if (*tok) args.push_back(tok);
+    args.push_back(const_cast<char*>("-")); /* dummy input */
+    args.push_back(0);
+
+    int argc = args.size() - 1;
+    char **argv = args.data();
+    optind = 0;
+    if (!parse(argc, argv))
+        return false;
+    if (this->tee_specs.size()) {
+        complain("--tee can't be nested.\n");
+        return false;
+    }
+    if (!isMP4()) {
+        complain("--tee output must be M4A.\n");
+        return false;
+    }
+    return true;
+}
@@ -36,7 +36,8 @@ struct Options {
 
         bits_per_sample(0), raw_channels(2), raw_sample_rate(44100),
         artwork_size(0), native_resampler_complexity(0), textcp(0),
-        gapless_mode(0),
+        gapless_mode(0), tmp_memory(256), cue_jobs(1),
+        input_cache_files(16), input_cache_size(256),
 
         ofilename(0), outdir(0), raw_format("S16LE"),
         fname_format("${tracknumber}${title& }${title}"),
@@ -51,12 +52,14 @@ struct Options {
         concat(false), no_matrix_normalize(false), no_dither(false),
         filename_from_tag(false), sort_args(false),
         no_smart_padding(false), limiter(false), copy_artwork(false),
+        cue_single_decoder(false), spool_input(false),
 
         bitrate(-1.0), gain(0.0),
 
         output_format(0)
     {}
     bool parse(int &argc, char **&argv);
+    bool parseTee(const std::string &spec);
 
     bool isMP4() const
     {
@@ -104,7 +107,8 @@ struct Options {
     unsigned num_priming;
     uint32_t bits_per_sample, raw_channels, raw_sample_rate,
              artwork_size, native_resampler_complexity, textcp,
-             gapless_mode;
+             gapless_mode, tmp_memory, cue_jobs, input_cache_files,
+             input_cache_size;
     const char
             *ofilename, *outdir, *raw_format, *fname_format, *chapter_file,
             *logfilename, *remix_preset, *remix_file, *tmpdir,
@@ -113,7 +117,8 @@ struct Options {
          ignore_length, no_optimize, native_resampler, check_only,
          normalize, print_available_formats, alac_fast, threading,
          concat, no_matrix_normalize, no_dither, filename_from_tag,
-         sort_args, no_smart_padding, limiter, copy_artwork;
+         sort_args, no_smart_padding, limiter, copy_artwork,
+         cue_single_decoder, spool_input;
     double bitrate, gain;
 
     uint32_t output_format;
@@ -123,10 +128,12 @@ struct Options {
     std::map<std::string, std::string> longtags;
     std::vector<misc::chapter_t> chapters;
     std::vector<std::string> artwork_files;
-    std::vector<std::vector<char> > artworks;
+    std::vector<misc::blob_t> artworks;
     std::string encoder_name;
     std::vector<uint32_t> chanmap;
     std::vector<int> cue_tracks;
+    std::vector<std::string> tee_specs;
+    std::shared_ptr<std::vector<char> > tee_args;
 };
 
 #endif
@@ -64,7 +64,7 @@ void parseMagicCookieALAC(const std::vector<uint8_t> &cookie,
 using mp4v2::impl::MP4Atom;
 
 MP4SinkBase::MP4SinkBase(const std::string &path, bool temp)
-        : m_filename(path), m_closed(false),
+        : m_filename(path), m_closed(false), m_pipe_out(false),
           m_edit_start(0), m_edit_duration(0),
           m_max_bitrate(0)
 {
@@ -73,10 +73,14 @@ MP4SinkBase::MP4SinkBase(const std::string &path, bool temp)
     if (temp) m_filename = "qaac.int";
     try {
         static MP4StdIOCallbacks callbacks;
-        if (path == "-") {
+        if (temp) {
+            m_fp = win32::tmpfile(m_filename.c_str());
+        } else if (path == "-" && !win32::is_seekable(fileno(stdout))) {
+            /* MP4 needs seeking; build it in a spool and stream on close */
+            m_pipe_out = true;
+            m_fp = win32::tmpfile("qaac.out");
+        } else if (path == "-") {
             m_fp = std::shared_ptr<FILE>(stdout, [](FILE *){});
-        } else if (temp) {
-            m_fp = std::shared_ptr<FILE>(win32::tmpfile(m_filename.c_str()), fclose);
         } else {
             m_fp = std::shared_ptr<FILE>(win32::wfopenx(m_filename.c_str(), "wb"), fclose);
         }
@@ -148,8 +152,8 @@ void MP4SinkBase::writeTags()
                 writeLongTag(li->first, li->second);
         }
         for (size_t i = 0; i < m_artworks.size(); ++i)
-            m_mp4file.SetMetadataArtwork("covr", &m_artworks[i][0],
-                                         m_artworks[i].size());
+            m_mp4file.SetMetadataArtwork("covr", m_artworks[i]->data(),
+                                         m_artworks[i]->size());
     } catch (mp4v2::impl::Exception *e) {
         handle_mp4error(e);
     }
@@ -164,6 +168,12 @@ void MP4SinkBase::close()
         } catch (mp4v2::impl::Exception *e) {
             handle_mp4error(e);
         }
+        if (m_pipe_out) {
+            int fd = fileno(m_fp.get());
+            CHECKCRT(std::fflush(m_fp.get()));
+            win32::copy_file_range(fd, 0, fileno(stdout), -1,
+                                   win32::filelengthi64(fd));
+        }
     }
 }
 
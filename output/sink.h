@@ -15,17 +15,19 @@ protected:
     MP4FileX m_mp4file;
     MP4TrackId m_track_id;
     bool m_closed;
+    bool m_pipe_out;
     uint32_t m_edit_start;
     uint64_t m_edit_duration;
     std::map<std::string, std::string> m_tags;
     std::vector<misc::chapter_t> m_chapters;
-    std::vector<std::vector<char> > m_artworks;
+    std::vector<misc::blob_t> m_artworks;
     unsigned m_max_bitrate;
 public:
     MP4SinkBase(const std::string &path, bool temp=false);
     virtual ~MP4SinkBase() {}
 
     MP4FileX *getFile() { return &m_mp4file; }
+    FILE *getFilePtr() { return m_fp.get(); }
     /* Don't automatically close, since close() involves finalizing */
     void close();
     void updateMaxBitrate(bool finilize=false);
@@ -39,7 +41,7 @@ public:
     {
         m_chapters.assign(first, last);
     }
-    void addArtwork(const std::vector<char> &data)
+    void addArtwork(const misc::blob_t &data)
     {
         m_artworks.push_back(data);
     }
@@ -1,6 +1,9 @@
+#include <map>
+#include <mutex>
+#include "wicimage.h"
+
 #ifdef __MINGW32__
 #include <stdexcept>
-#include "wicimage.h"
 
 bool WICConvertArtwork(const void *data, size_t size, unsigned maxSize,
         std::vector<char> *outImage)
@@ -22,7 +25,6 @@ bool WICConvertArtwork(const void *data, size_t size, unsigned maxSize,
 #pragma warning(pop)
 #include "util.h"
 #include "win32util.h"
-#include "wicimage.h"
 
 _COM_SMARTPTR_TYPEDEF(IStream, __uuidof(IStream));
 _COM_SMARTPTR_TYPEDEF(IPropertyBag2, __uuidof(IPropertyBag2));
@@ -115,3 +117,46 @@ bool WICConvertArtwork(const void *data, size_t size, unsigned maxSize,
     return true;
 }
 #endif // _MSC_VER
+
+misc::blob_t WICConvertArtworkCached(const misc::blob_t &data,
+                                     unsigned maxSize)
+{
+    /*
+     * The original is held weakly, so that an entry goes away together
+     * with the last input using the picture. converted is null when the
+     * original is fine as it is.
+     */
+    struct Entry {
+        std::weak_ptr<const std::vector<char> > original;
+        misc::blob_t converted;
+    };
+    static std::mutex mutex;
+    /* (hash, maxSize) -> entry */
+    static std::multimap<std::pair<uint64_t, unsigned>, Entry> cache;
+
+    auto key = std::make_pair(misc::hashBlob(data->data(), data->size()),
+                              maxSize);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto range = cache.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            misc::blob_t original = it->second.original.lock();
+            if (original && *original == *data)
+                return it->second.converted ? it->second.converted : data;
+        }
+    }
+    std::vector<char> vec;
+    misc::blob_t result;
+    if (WICConvertArtwork(data->data(), data->size(), maxSize, &vec))
+        result = misc::internBlob(vec.data(), vec.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = cache.begin(); it != cache.end(); )
+        if (it->second.original.expired())
+            it = cache.erase(it);
+        else
+            ++it;
+    Entry entry = { data, result };
+    cache.insert(std::make_pair(key, entry));
+    return result ? result : data;
+}
@@ -1,4 +1,14 @@
 #include <vector>
+#include "misc.h"
 
 bool WICConvertArtwork(const void *data, size_t size, unsigned maxSize,
         std::vector<char> *outImage);
+
+/*
+ * WICConvertArtwork() on a shared picture. Results are remembered by
+ * content hash for as long as the original picture is alive, so a
+ * picture shared by a whole album is resized once. Returns data itself
+ * if no resizing was needed.
+ */
+misc::blob_t WICConvertArtworkCached(const misc::blob_t &data,
+                                     unsigned maxSize);
@@ -6,9 +6,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <cerrno>
 #include <cstring>
 #include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <atomic>
 #include "strutil.h"
 
 namespace win32 {
@@ -32,24 +36,124 @@ namespace win32 {
         throw std::runtime_error((ss));
     }
 
-    FILE *tmpfile(const char *prefix)
+    /*
+     * Temporary files are memfd backed while the sum of their sizes stays
+     * under the budget. Writers announce growth by tmpfile_reserve(); a
+     * file that doesn't fit anymore is copied to a real file under $TMP
+     * which is then dup2()'ed over the memfd, so that callers keep using
+     * the same descriptor (and FILE*) transparently.
+     */
+    struct TmpfileSpool {
+        std::mutex mutex;
+        std::atomic<size_t> count;
+        uint64_t limit, total;
+        std::map<int, uint64_t> files;
+
+        TmpfileSpool(): count(0), limit(256ULL << 20), total(0) {}
+        static TmpfileSpool &instance()
+        {
+            static TmpfileSpool self;
+            return self;
+        }
+        void add(int fd)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            files[fd] = 0;
+            count = files.size();
+        }
+        void remove(int fd)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = files.find(fd);
+            if (it == files.end())
+                return;
+            total -= it->second;
+            files.erase(it);
+            count = files.size();
+        }
+    };
+
+    static int tmpfile_on_disk(const char *prefix)
     {
+        const char *dir = getenv("TMP");
+        if (!dir || !*dir) dir = getenv("TMPDIR");
+        if (!dir || !*dir) dir = "/tmp";
 
         std::string template_name =
-            strutil::format("%s.%d.XXXXXX", prefix, getpid());
+            strutil::format("%s/%s.%d.XXXXXX", dir, prefix, getpid());
 
         int fd = mkstemp((char*)template_name.c_str());
         if (fd == -1) {
             util::throw_crt_error("win32::tmpfile: mkstemp()");
         }
+        unlink(template_name.c_str());
+        return fd;
+    }
+
+    void set_tmpfile_memory_limit(uint64_t bytes)
+    {
+        TmpfileSpool &spool = TmpfileSpool::instance();
+        std::lock_guard<std::mutex> lock(spool.mutex);
+        spool.limit = bytes;
+    }
+
+    std::shared_ptr<FILE> tmpfile(const char *prefix)
+    {
+        TmpfileSpool &spool = TmpfileSpool::instance();
+        int fd = -1;
+        {
+            std::lock_guard<std::mutex> lock(spool.mutex);
+            if (spool.limit > spool.total)
+                fd = memfd_create(prefix, MFD_CLOEXEC);
+        }
+        if (fd >= 0)
+            spool.add(fd);
+        else
+            fd = tmpfile_on_disk(prefix);
 
         FILE *fp = fdopen(fd, "w+");
         if (!fp) {
+            spool.remove(fd);
             close(fd);
             util::throw_crt_error("win32::tmpfile: _fdopen()");
         }
+        return std::shared_ptr<FILE>(fp, [](FILE *fp) {
+                                         TmpfileSpool::instance()
+                                             .remove(fileno(fp));
+                                         std::fclose(fp);
+                                     });
+    }
 
-        return fp;
+    void tmpfile_reserve(int fd, uint64_t size)
+    {
+        TmpfileSpool &spool = TmpfileSpool::instance();
+        if (!spool.count)
+            return;
+        std::lock_guard<std::mutex> lock(spool.mutex);
+        auto it = spool.files.find(fd);
+        if (it == spool.files.end() || it->second >= size)
+            return;
+        if (spool.total - it->second + size <= spool.limit) {
+            spool.total += size - it->second;
+            it->second = size;
+            return;
+        }
+        int64_t pos = lseek(fd, 0, SEEK_CUR);
+        int64_t len = filelengthi64(fd);
+        CHECKCRT(pos < 0 || len < 0);
+        int nfd = tmpfile_on_disk("qaac.spill");
+        try {
+            copy_file_range(fd, 0, nfd, 0, len);
+            CHECKCRT(lseek(nfd, pos, SEEK_SET) < 0);
+            CHECKCRT(dup2(nfd, fd) < 0);
+        } catch (...) {
+            close(nfd);
+            throw;
+        }
+        close(nfd);
+        spool.total -= it->second;
+        spool.files.erase(it);
+        spool.count = spool.files.size();
     }
 
     char *load_with_mmap(const char *path, uint64_t *size)
@@ -118,6 +222,72 @@ namespace win32 {
         return statA.st_dev == statB.st_dev && statA.st_ino == statB.st_ino;
     }
 
+    /*
+     * Copy a byte range between two descriptors without passing it through
+     * user space when possible. copy_file_range() lets the filesystem share
+     * extents (reflink on btrfs/XFS) or do a server side copy. When it
+     * refuses (cross device, old kernel, special file), try sendfile(),
+     * then fall back to plain pread()/pwrite().
+     * File offsets of both descriptors are left untouched, except when
+     * off_out is negative: then output goes to the current position of
+     * fdout, which may be a pipe.
+     */
+    void copy_file_range(int fdin, int64_t off_in, int fdout, int64_t off_out,
+                         uint64_t size)
+    {
+        enum { COPY_RANGE, SENDFILE, READWRITE };
+        int method = COPY_RANGE;
+        std::vector<char> buffer;
+
+        while (size > 0) {
+            size_t chunk = std::min(size, static_cast<uint64_t>(0x40000000));
+            ssize_t n = -1;
+            if (method == COPY_RANGE) {
+                loff_t ioff = off_in, ooff = off_out;
+                n = ::copy_file_range(fdin, &ioff, fdout,
+                                      off_out < 0 ? nullptr : &ooff, chunk, 0);
+                if (n < 0 && (errno == EXDEV || errno == EINVAL ||
+                              errno == ENOSYS || errno == EOPNOTSUPP ||
+                              errno == EBADF)) {
+                    method = SENDFILE;
+                    continue;
+                }
+            } else if (method == SENDFILE) {
+                off_t ioff = off_in;
+                if (off_out >= 0)
+                    CHECKCRT(lseek(fdout, off_out, SEEK_SET) < 0);
+                n = ::sendfile(fdout, fdin, &ioff, chunk);
+                if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                    method = READWRITE;
+                    continue;
+                }
+            } else {
+                if (buffer.empty())
+                    buffer.resize(0x100000);
+                chunk = std::min(chunk, buffer.size());
+                n = pread(fdin, buffer.data(), chunk, off_in);
+                for (ssize_t done = 0, m; n > 0 && done < n; done += m) {
+                    m = off_out < 0
+                        ? write(fdout, buffer.data() + done, n - done)
+                        : pwrite(fdout, buffer.data() + done, n - done,
+                                 off_out + done);
+                    if (m < 0) util::throw_crt_error("pwrite()");
+                }
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                util::throw_crt_error("win32::copy_file_range()");
+            if (n == 0)
+                throw std::runtime_error("win32::copy_file_range(): "
+                                         "unexpected end of file");
+            off_in  += n;
+            if (off_out >= 0)
+                off_out += n;
+            size    -= n;
+        }
+    }
+
     std::string GetFullPathName(const std::string &path) {
         char resolved_path[PATH_MAX];
         if (realpath(path.c_str(), resolved_path) != nullptr) {
@@ -69,7 +69,11 @@ namespace win32 {
 
     int64_t filelengthi64(int fd);
 
-    FILE *tmpfile(const char *prefix);
+    void set_tmpfile_memory_limit(uint64_t bytes);
+
+    std::shared_ptr<FILE> tmpfile(const char *prefix);
+
+    void tmpfile_reserve(int fd, uint64_t size);
 
     char *load_with_mmap(const char *path, uint64_t *size);
 
@@ -77,5 +81,8 @@ namespace win32 {
 
     bool is_same_file(int fda, int fdb);
 
+    void copy_file_range(int fdin, int64_t off_in, int fdout, int64_t off_out,
+                         uint64_t size);
+
 }
 #endif